@@ -0,0 +1,165 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULLING_SSE
+#endif
+
+// planes are stored as (n, d) with n pointing inside, a point p is inside when dot(n, p) + d >= 0
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+// Gribb/Hartmann plane extraction from the combined projection * view matrix
+inline Frustum extractFrustum(const glm::mat4& viewProjection) {
+	glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+	glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+	glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+	glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+	Frustum f;
+	f.planes[0] = row3 + row0;
+	f.planes[1] = row3 - row0;
+	f.planes[2] = row3 + row1;
+	f.planes[3] = row3 - row1;
+#ifdef GLM_FORCE_DEPTH_ZERO_TO_ONE
+	f.planes[4] = row2;
+#else
+	f.planes[4] = row3 + row2;
+#endif
+	f.planes[5] = row3 - row2;
+	for (int i = 0; i < 6; i++) {
+		float len = std::sqrt(f.planes[i].x * f.planes[i].x + f.planes[i].y * f.planes[i].y + f.planes[i].z * f.planes[i].z);
+		f.planes[i] = f.planes[i] / len;
+	}
+	return f;
+}
+
+inline bool sphereInFrustum(const Frustum& f, glm::vec3 c, float r) {
+	for (int i = 0; i < 6; i++) {
+		if (f.planes[i].x * c.x + f.planes[i].y * c.y + f.planes[i].z * c.z + f.planes[i].w < -r)
+			return false;
+	}
+	return true;
+}
+
+// bounding spheres kept as separate arrays so the test runs four bodies per plane at a time
+struct BoundsBatch {
+	std::vector<float> x, y, z, r;
+	std::vector<uint8_t> visible;
+
+	void resize(size_t n) {
+		x.resize(n);
+		y.resize(n);
+		z.resize(n);
+		r.resize(n);
+		visible.resize(n);
+	}
+};
+
+// fills batch.visible, returns the number of spheres that survive
+inline size_t cullSpheres(const Frustum& f, BoundsBatch& batch) {
+	size_t n = batch.x.size();
+	size_t count = 0;
+	size_t i = 0;
+#ifdef CULLING_SSE
+	for (; i + 4 <= n; i += 4) {
+		__m128 cx = _mm_loadu_ps(&batch.x[i]);
+		__m128 cy = _mm_loadu_ps(&batch.y[i]);
+		__m128 cz = _mm_loadu_ps(&batch.z[i]);
+		__m128 nr = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&batch.r[i]));
+		__m128 inside = _mm_cmpeq_ps(cx, cx);
+		for (int p = 0; p < 6; p++) {
+			__m128 d = _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(f.planes[p].x)), _mm_mul_ps(cy, _mm_set1_ps(f.planes[p].y)));
+			d = _mm_add_ps(d, _mm_mul_ps(cz, _mm_set1_ps(f.planes[p].z)));
+			d = _mm_add_ps(d, _mm_set1_ps(f.planes[p].w));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(d, nr));
+		}
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4; k++) {
+			batch.visible[i + k] = (mask >> k) & 1;
+			count += batch.visible[i + k];
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		batch.visible[i] = sphereInFrustum(f, glm::vec3(batch.x[i], batch.y[i], batch.z[i]), batch.r[i]);
+		count += batch.visible[i];
+	}
+	return count;
+}
+
+// one level of detail, a range of the object's element buffer
+struct MeshLod {
+	uint32_t first;
+	uint32_t count;
+};
+
+// projected radius as a fraction of the half screen height below which each coarser level kicks in
+const float LOD_SCREEN_SIZE[] = { 0.25f, 0.1f, 0.04f };
+
+// builds coarser index buffers by vertex clustering on a grid, levels that do not drop any triangles are skipped.
+// vertex positions are untouched, a cluster is drawn with the first vertex that landed in it
+template<typename V, typename VA, typename IA>
+std::vector<std::vector<uint32_t>> buildLods(const std::vector<V, VA>& vertices, const std::vector<uint32_t, IA>& indices) {
+	std::vector<std::vector<uint32_t>> lods;
+	if (vertices.empty())
+		return lods;
+	glm::vec3 lo = vertices[0].pos;
+	glm::vec3 hi = vertices[0].pos;
+	for (const V& v : vertices) {
+		lo = glm::min(lo, v.pos);
+		hi = glm::max(hi, v.pos);
+	}
+	float extent = glm::max(glm::max(hi.x - lo.x, hi.y - lo.y), glm::max(hi.z - lo.z, 1e-6f));
+	size_t previous = indices.size();
+	for (int cells : { 16, 8, 4 }) {
+		float cell = extent / cells;
+		std::unordered_map<uint64_t, uint32_t> clusters;
+		std::vector<uint32_t> remap(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			glm::vec3 g = (vertices[i].pos - lo) / cell;
+			uint64_t key = (uint64_t(g.x) << 42) | (uint64_t(g.y) << 21) | uint64_t(g.z);
+			auto it = clusters.emplace(key, static_cast<uint32_t>(i)).first;
+			remap[i] = it->second;
+		}
+		std::vector<uint32_t> lod;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			uint32_t a = remap[indices[i]];
+			uint32_t b = remap[indices[i + 1]];
+			uint32_t c = remap[indices[i + 2]];
+			if (a != b && b != c && c != a) {
+				lod.push_back(a);
+				lod.push_back(b);
+				lod.push_back(c);
+			}
+		}
+		if (lod.empty() || lod.size() >= previous)
+			continue;
+		previous = lod.size();
+		lods.push_back(lod);
+	}
+	return lods;
+}
+
+// picks a level from the projected size of the bounding sphere, projection11 is projection[1][1]
+inline size_t selectLod(glm::vec3 camera, glm::vec3 centre, float radius, float projection11, size_t levels) {
+	float dist = glm::length(centre - camera);
+	if (dist <= radius)
+		return 0;
+	float size = radius * projection11 / dist;
+	size_t level = 0;
+	while (level + 1 < levels && level < sizeof(LOD_SCREEN_SIZE) / sizeof(LOD_SCREEN_SIZE[0]) && size < LOD_SCREEN_SIZE[level])
+		level++;
+	return level;
+}
+
+#endif
@@ -0,0 +1,391 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "shapes.h"
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define DOMAIN_PROCESSES
+#endif
+
+// one body as it travels between worker processes, plain data so it can go over a socket as is
+struct BodyRecord {
+	uint64_t id;
+	glm::vec3 x;
+	glm::vec3 P;
+	glm::quat q;
+	glm::vec3 L;
+	glm::vec3 push;		// contact directions of the last step, see findDerivativeState
+	float m;
+	float inertia;		// isotropic, like the tensor constructObj builds
+	Shape shape;
+	uint8_t dynamic;
+};
+
+// geometry every worker keeps a copy of, like the ground half-space
+struct DomainStatic {
+	Shape shape;
+	glm::vec3 x;
+	glm::quat q;
+};
+
+// the world split into slabs along x, bodies outside [minX, maxX] belong to the end slabs
+struct DomainLayout {
+	float minX, maxX;
+	int regions;
+
+	int regionOf(float x) const {
+		int r = static_cast<int>(std::floor((x - minX) / (maxX - minX) * regions));
+		return glm::clamp(r, 0, regions - 1);
+	}
+	float lo(int r) const {
+		return r == 0 ? -INFINITY : minX + (maxX - minX) * r / regions;
+	}
+	float hi(int r) const {
+		return r == regions - 1 ? INFINITY : minX + (maxX - minX) * (r + 1) / regions;
+	}
+};
+
+// radius of the sphere around the body origin that encloses the shape, used by the sweep.
+// bodies need a finite shape, half-spaces go in as DomainStatic
+inline float boundingRadius(const Shape& shape) {
+	switch (shape.type) {
+	case SHAPE_SPHERE:
+		return shape.radius;
+	case SHAPE_BOX:
+		return glm::length(shape.halfExtents);
+	case SHAPE_CAPSULE:
+		return shape.radius + shape.halfHeight;
+	default:
+		return INFINITY;
+	}
+}
+
+// the single point impulse of the collision handling loop in main
+inline void respondRecord(BodyRecord& b, glm::vec3 point, glm::vec3 dir) {
+	glm::vec3 ra = b.x - point;
+	float ii = 1.0f / b.inertia;
+	glm::vec3 vm = b.P / b.m + glm::cross(b.P * ii, ra);
+	float vmf = glm::dot(vm, dir);
+	float a = -1.0f * vmf / (1.0f / b.m + glm::dot(dir, glm::cross(glm::cross(ra, dir) * ii, ra)));
+	b.P += a * dir;
+	b.L += a * glm::cross(ra, dir);
+	b.push += dir;
+}
+
+// explicit Euler with the derivative of findDerivativeState
+inline void integrateRecord(BodyRecord& b, float h) {
+	glm::vec3 w = b.L / b.inertia;
+	glm::quat dq = glm::quat(0.0f, w) * b.q / 2.0f;
+	b.x += h * b.P / b.m;
+	b.P += h * (b.push / 5.0f + glm::vec3(0.0f, 0.0f, -2.0f));
+	b.q = glm::normalize(b.q + h * dq);
+	b.push = glm::vec3(0.0f);
+}
+
+// state of one region: the bodies it owns and read-only ghost copies of its neighbours' border bodies
+class DomainWorker
+{
+public:
+	DomainWorker(const DomainLayout& layout, int region, const std::vector<DomainStatic>& statics, float margin)
+		: layout(layout), region(region), statics(statics), margin(margin) {
+	}
+
+	std::vector<BodyRecord> owned;
+	std::vector<BodyRecord> ghosts;
+
+	// largest distance an owned body moved in the last integrate
+	float travelled = 0.0f;
+
+	void integrate(float h) {
+		travelled = 0.0f;
+		for (BodyRecord& b : owned) {
+			if (b.dynamic) {
+				glm::vec3 x = b.x;
+				integrateRecord(b, h);
+				travelled = glm::max(travelled, glm::length(b.x - x));
+			}
+		}
+	}
+
+	// owned bodies whose extent reaches within margin of the lower or upper border, these become ghosts on that side.
+	// ghosts are swapped before the handoff, so a neighbour's body can be up to one step's travel past the border
+	// and still belong to it. Both halves of such a pair only see each other while the margin covers that travel
+	// plus the neighbour's radius, see runDomains
+	std::vector<BodyRecord> border(bool upper) const {
+		std::vector<BodyRecord> out;
+		for (const BodyRecord& b : owned) {
+			float r = boundingRadius(b.shape);
+			if (upper ? b.x.x + r > layout.hi(region) - margin : b.x.x - r < layout.lo(region) + margin)
+				out.push_back(b);
+		}
+		return out;
+	}
+
+	// contacts against owned, ghost and static geometry. Only owned bodies respond, the other side of a ghost
+	// pair is resolved by its owner from the same states, so both halves see identical input
+	void collide() {
+		std::vector<BodyRecord*> sweep;
+		for (BodyRecord& b : owned)
+			sweep.push_back(&b);
+		for (BodyRecord& b : ghosts)
+			sweep.push_back(&b);
+		std::sort(sweep.begin(), sweep.end(), [](BodyRecord* a, BodyRecord* b) {
+			float ka = a->x.x - boundingRadius(a->shape);
+			float kb = b->x.x - boundingRadius(b->shape);
+			return ka < kb || (ka == kb && a->id < b->id);
+		});
+		// contacts are gathered first so a response never changes the input of a later pair
+		std::vector<std::pair<BodyRecord*, std::pair<glm::vec3, glm::vec3>>> hits;
+		ShapeContact contacts[MAX_SHAPE_CONTACTS];
+		for (size_t i = 0; i < sweep.size(); i++) {
+			BodyRecord* a = sweep[i];
+			float reach = a->x.x + boundingRadius(a->shape);
+			for (size_t j = i + 1; j < sweep.size() && sweep[j]->x.x - boundingRadius(sweep[j]->shape) <= reach; j++) {
+				BodyRecord* b = sweep[j];
+				bool ownA = isOwned(a), ownB = isOwned(b);
+				if ((!ownA && !ownB) || (!a->dynamic && !b->dynamic))
+					continue;
+				// lower id first so every worker orients the pair the same way
+				BodyRecord* first = a->id < b->id ? a : b;
+				BodyRecord* second = a->id < b->id ? b : a;
+				int count = collideShapes(first->shape, makePose(first->x, first->q), second->shape, makePose(second->x, second->q), contacts);
+				for (int c = 0; c < count; c++) {
+					if (isOwned(first) && first->dynamic)
+						hits.push_back({ first, { contacts[c].point, -contacts[c].normal } });
+					if (isOwned(second) && second->dynamic)
+						hits.push_back({ second, { contacts[c].point, -contacts[c].normal } });
+				}
+			}
+		}
+		for (BodyRecord& b : owned) {
+			if (!b.dynamic)
+				continue;
+			for (const DomainStatic& s : statics) {
+				int count = collideShapes(b.shape, makePose(b.x, b.q), s.shape, makePose(s.x, s.q), contacts);
+				// the normal points from the body into the static, flipped so the push points out of it
+				for (int c = 0; c < count; c++)
+					hits.push_back({ &b, { contacts[c].point, -contacts[c].normal } });
+			}
+		}
+		for (auto& hit : hits)
+			respondRecord(*hit.first, hit.second.first, hit.second.second);
+	}
+
+	// removes and returns the owned bodies that now belong to the lower or upper neighbour
+	std::vector<BodyRecord> leaving(bool upper) {
+		std::vector<BodyRecord> out;
+		std::vector<BodyRecord> keep;
+		for (const BodyRecord& b : owned) {
+			int r = layout.regionOf(b.x.x);
+			if (r != region && (r > region) == upper)
+				out.push_back(b);
+			else
+				keep.push_back(b);
+		}
+		owned.swap(keep);
+		return out;
+	}
+
+	// step travel a body may have before the margin stops covering its neighbours,
+	// radius is the largest bounding radius of any body in the layout
+	void setMaxRadius(float radius) {
+		maxRadius = radius;
+	}
+
+	float travelBudget() const {
+		return margin - 2.0f * maxRadius;
+	}
+
+	// takes over arriving bodies, owned stays sorted by id so every run visits bodies in the same order
+	void arrive(const std::vector<BodyRecord>& bodies) {
+		owned.insert(owned.end(), bodies.begin(), bodies.end());
+		std::sort(owned.begin(), owned.end(), [](const BodyRecord& a, const BodyRecord& b) { return a.id < b.id; });
+	}
+
+private:
+	DomainLayout layout;
+	int region;
+	std::vector<DomainStatic> statics;
+	float margin;
+	float maxRadius = 0.0f;
+
+	bool isOwned(const BodyRecord* b) const {
+		return b >= owned.data() && b < owned.data() + owned.size();
+	}
+};
+
+#ifdef DOMAIN_PROCESSES
+
+inline bool writeAll(int fd, const void* data, size_t bytes) {
+	const char* p = static_cast<const char*>(data);
+	while (bytes > 0) {
+		ssize_t n = ::write(fd, p, bytes);
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+inline bool readAll(int fd, void* data, size_t bytes) {
+	char* p = static_cast<char*>(data);
+	while (bytes > 0) {
+		ssize_t n = ::read(fd, p, bytes);
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+inline bool sendBodies(int fd, const std::vector<BodyRecord>& bodies) {
+	uint64_t count = bodies.size();
+	return writeAll(fd, &count, sizeof(count)) && (count == 0 || writeAll(fd, bodies.data(), count * sizeof(BodyRecord)));
+}
+
+inline bool receiveBodies(int fd, std::vector<BodyRecord>& bodies) {
+	uint64_t count = 0;
+	if (!readAll(fd, &count, sizeof(count)))
+		return false;
+	bodies.resize(count);
+	return count == 0 || readAll(fd, bodies.data(), count * sizeof(BodyRecord));
+}
+
+// sends to one side and then receives from the other. The last worker in the direction of travel only
+// receives, so a chain of blocked writes always drains and neighbours cannot deadlock
+inline bool shiftBodies(int sendFd, const std::vector<BodyRecord>& out, int receiveFd, std::vector<BodyRecord>& in) {
+	in.clear();
+	if (sendFd >= 0 && !sendBodies(sendFd, out))
+		return false;
+	return receiveFd < 0 || receiveBodies(receiveFd, in);
+}
+
+// lower/upper are the sockets to the neighbours, -1 at the ends of the layout
+inline bool runDomainWorker(DomainWorker& worker, int lower, int upper, float h, int steps) {
+	std::vector<BodyRecord> in, fromLower, fromUpper;
+	for (int step = 0; step < steps; step++) {
+		worker.integrate(h);
+		if (worker.travelled > worker.travelBudget()) {
+			std::printf("ERROR::DOMAIN::BODY_TOO_FAST: moved %f in one step, the ghost margin allows %f\n", worker.travelled, worker.travelBudget());
+			return false;
+		}
+		// ghosts from the same time level on both sides
+		if (!shiftBodies(upper, worker.border(true), lower, fromLower))
+			return false;
+		if (!shiftBodies(lower, worker.border(false), upper, fromUpper))
+			return false;
+		worker.ghosts = fromLower;
+		worker.ghosts.insert(worker.ghosts.end(), fromUpper.begin(), fromUpper.end());
+		worker.collide();
+		// hand off the bodies that crossed a border
+		if (!shiftBodies(upper, worker.leaving(true), lower, fromLower))
+			return false;
+		if (!shiftBodies(lower, worker.leaving(false), upper, fromUpper))
+			return false;
+		worker.arrive(fromLower);
+		worker.arrive(fromUpper);
+	}
+	return true;
+}
+
+// forks one worker process per region connected in a line by local sockets, steps them and gathers the
+// bodies back, sorted by id. Returns false when a worker could not be started or dropped out.
+// margin has to be at least 2 * the largest bounding radius + the largest distance a body moves in one step,
+// otherwise a body that just crossed a border can touch a neighbour that is not ghosted back to it and only one
+// side of the contact responds. Workers stop with an error when a body outruns that budget. Slabs have to be
+// wider than twice the margin so ghosts only ever go to the adjacent region
+inline bool runDomains(const DomainLayout& layout, const std::vector<BodyRecord>& bodies, const std::vector<DomainStatic>& statics,
+	float h, int steps, float margin, std::vector<BodyRecord>& result) {
+	int regions = layout.regions;
+	float maxRadius = 0.0f;
+	for (const BodyRecord& b : bodies)
+		maxRadius = glm::max(maxRadius, boundingRadius(b.shape));
+	if (margin < 2.0f * maxRadius || (regions > 1 && (layout.maxX - layout.minX) / regions <= 2.0f * margin)) {
+		std::printf("ERROR::DOMAIN::MARGIN: %f does not fit bodies of radius %f in slabs of width %f\n", margin, maxRadius, (layout.maxX - layout.minX) / regions);
+		return false;
+	}
+	std::vector<int> links(2 * regions, -1);	// links[2r] to r + 1 from r, links[2r + 1] the other end
+	std::vector<int> control(2 * regions, -1);
+	for (int r = 0; r < regions; r++) {
+		if (r + 1 < regions && socketpair(AF_UNIX, SOCK_STREAM, 0, &links[2 * r]) != 0)
+			return false;
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, &control[2 * r]) != 0)
+			return false;
+	}
+	std::fflush(stdout);
+	std::vector<pid_t> pids;
+	for (int r = 0; r < regions; r++) {
+		pid_t pid = fork();
+		if (pid < 0)
+			break;
+		if (pid == 0) {
+			int lower = r > 0 ? links[2 * (r - 1) + 1] : -1;
+			int upper = r + 1 < regions ? links[2 * r] : -1;
+			int parent = control[2 * r + 1];
+			for (int i = 0; i < 2 * regions; i++) {
+				if (links[i] >= 0 && links[i] != lower && links[i] != upper)
+					close(links[i]);
+				if (control[i] != parent)
+					close(control[i]);
+			}
+			DomainWorker worker(layout, r, statics, margin);
+			worker.setMaxRadius(maxRadius);
+			std::vector<BodyRecord> start;
+			bool ok = receiveBodies(parent, start);
+			worker.arrive(start);
+			ok = ok && runDomainWorker(worker, lower, upper, h, steps);
+			ok = ok && sendBodies(parent, worker.owned);
+			_exit(ok ? 0 : 1);
+		}
+		pids.push_back(pid);
+	}
+	for (int i = 0; i < 2 * regions; i++) {
+		if (links[i] >= 0)
+			close(links[i]);
+		if (i % 2 == 1)
+			close(control[i]);
+	}
+	bool ok = static_cast<int>(pids.size()) == regions;
+	if (ok) {
+		std::vector<std::vector<BodyRecord>> initial(regions);
+		for (const BodyRecord& b : bodies)
+			initial[layout.regionOf(b.x.x)].push_back(b);
+		for (int r = 0; r < regions; r++)
+			ok = sendBodies(control[2 * r], initial[r]) && ok;
+	}
+	result.clear();
+	for (int r = 0; r < regions; r++) {
+		std::vector<BodyRecord> part;
+		if (ok && receiveBodies(control[2 * r], part))
+			result.insert(result.end(), part.begin(), part.end());
+		else
+			ok = false;
+		close(control[2 * r]);
+	}
+	for (pid_t pid : pids) {
+		int status = 0;
+		waitpid(pid, &status, 0);
+		ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+	std::sort(result.begin(), result.end(), [](const BodyRecord& a, const BodyRecord& b) { return a.id < b.id; });
+	return ok;
+}
+
+#endif
+
+#endif
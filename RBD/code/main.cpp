@@ -33,8 +33,21 @@
 #include <array>
 #include <chrono>
 #include <unordered_map>
+#include <memory>
+#include <deque>
 
 #include "shader.h"
+#include "shapes.h"
+#include "culling.h"
+#include "threadpool.h"
+#include "worldbatch.h"
+#include "offscreen.h"
+#include "domain.h"
+#include "particles.h"
+#include "objectpool.h"
+#include "memtrack.h"
+#include "vertexformat.h"
+#include "paircache.h"
 
 glm::vec3 camPos = glm::vec3(5.0f, 5.0f, 0.0f);
 glm::vec3 camFront = glm::vec3(0.0f, 0.0f, -1.0f);
@@ -52,6 +65,8 @@ float fov = 45.0f;
 float deltaTimeFrame = .0f;
 float lastFrame = .0f;
 bool timeToSimulate = false;
+// set once the shader is linked, an older vertRBD.glsl gets the float vertices in world space every frame
+bool packedVertices = true;
 
 struct Vertex {
 	glm::vec3 pos;
@@ -107,25 +122,31 @@ struct State {
 struct Impulse {
 	glm::vec3 pos;
 	glm::vec3 dir;
-	std::vector<glm::vec3> points;
+	TrackedVector<glm::vec3, MEM_CONTACTS> points;
 };
 
 struct Object {
 	State s;
 	State ps;
-	int index;
+	PoolHandle handle;
 	std::string model_path;
 	unsigned int vao, vbo, ebo;
-	std::vector<Vertex> vertices;
-	std::vector<VertexData> drawData;
-	std::vector<uint32_t> indices;
-	std::vector<Edge> edges;
-	std::vector<Face> faces;
-	std::vector<Impulse> impulses;
-	std::vector<float> masses;
+	TrackedVector<Vertex, MEM_MESH> vertices;
+	TrackedVector<uint32_t, MEM_MESH> indices;
+	TrackedVector<Edge, MEM_TOPOLOGY> edges;
+	TrackedVector<Face, MEM_TOPOLOGY> faces;
+	TrackedVector<Impulse, MEM_CONTACTS> impulses;
+	TrackedVector<float, MEM_MESH> masses;
 	float m;
 	bool dynamic;
 	glm::mat3x3 I;
+	Shape shape;
+	float boundRadius;
+	std::vector<MeshLod> lods;
+	TrackedVector<uint32_t, MEM_MESH> elements; // element buffer contents until uploadObj hands them to GL
+	TrackedVector<RenderVertex, MEM_MESH> renderData; // vertex buffer contents, likewise
+	glm::mat4 meshToLocal; // undoes the position quantization of renderData
+	TrackedVector<VertexData, MEM_MESH> drawData; // world space vertices when packedVertices is off
 };
 
 namespace std {
@@ -212,7 +233,7 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 		fov = 45.0f;
 }
 
-void loadModel(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::string model_path) {
+void loadModel(TrackedVector<Vertex, MEM_MESH>& vertices, TrackedVector<uint32_t, MEM_MESH>& indices, std::string model_path) {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
@@ -280,28 +301,26 @@ void processInput(GLFWwindow* window)
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
-Object constructObj(std::string model_path, bool dynamic, float i) {
+// everything that does not touch GL, safe to run on a worker thread
+Object prepareObj(std::string model_path, bool dynamic, float i) {
 	Object obj{};
 	obj.dynamic = dynamic;
 	obj.model_path = model_path;
 	loadModel(obj.vertices, obj.indices, obj.model_path);
+	if (packedVertices)
+		obj.meshToLocal = quantizeVertices(obj.vertices, obj.renderData);
+
+	// the full index list is level 0, the simplified ones are appended to the same element buffer
+	obj.elements = obj.indices;
+	obj.lods.push_back({ 0, static_cast<uint32_t>(obj.indices.size()) });
+	for (const std::vector<uint32_t>& lod : buildLods(obj.vertices, obj.indices)) {
+		obj.lods.push_back({ static_cast<uint32_t>(obj.elements.size()), static_cast<uint32_t>(lod.size()) });
+		obj.elements.insert(obj.elements.end(), lod.begin(), lod.end());
+	}
+	obj.boundRadius = 0.0f;
 	for (int i = 0; i < obj.vertices.size(); i++) {
-		obj.drawData.push_back({ obj.vertices[i].pos ,obj.vertices[i].normal ,obj.vertices[i].texCoord });
+		obj.boundRadius = glm::max(obj.boundRadius, glm::length(obj.vertices[i].pos));
 	}
-	glGenVertexArrays(1, &obj.vao);
-	glGenBuffers(1, &obj.vbo);
-	glGenBuffers(1, &obj.ebo);
-
-	glBindVertexArray(obj.vao);
-	glBindBuffer(GL_ARRAY_BUFFER, obj.vbo);
-	glBufferData(GL_ARRAY_BUFFER, obj.drawData.size() * sizeof(Vertex), &obj.drawData[0], GL_DYNAMIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, obj.indices.size() * sizeof(float), &obj.indices[0], GL_DYNAMIC_DRAW);
 	obj.s.x = glm::vec3(0.0f, 0.0f, 0.0f);
 	obj.s.P = glm::vec3(0.0f, 0.0f, 0.0f);
 	obj.s.L = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -345,6 +364,74 @@ Object constructObj(std::string model_path, bool dynamic, float i) {
 void loadObjBufferData(Object& obj) {
 	glBindBuffer(GL_ARRAY_BUFFER, obj.vbo);
 	glBufferData(GL_ARRAY_BUFFER, obj.drawData.size() * sizeof(Vertex), &obj.drawData[0], GL_DYNAMIC_DRAW);
+	gpuMemory().buffer(obj.vbo, obj.drawData.size() * sizeof(Vertex));
+}
+
+// creates the GL buffers, has to run on the thread that owns the context
+void uploadObj(Object& obj) {
+	glGenVertexArrays(1, &obj.vao);
+	glGenBuffers(1, &obj.vbo);
+	glGenBuffers(1, &obj.ebo);
+
+	glBindVertexArray(obj.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, obj.vbo);
+	if (packedVertices) {
+		glBufferData(GL_ARRAY_BUFFER, obj.renderData.size() * sizeof(RenderVertex), &obj.renderData[0], GL_STATIC_DRAW);
+		renderVertexAttribs();
+		gpuMemory().buffer(obj.vbo, obj.renderData.size() * sizeof(RenderVertex));
+	}
+	else {
+		for (int i = 0; i < obj.vertices.size(); i++) {
+			obj.drawData.push_back({ obj.vertices[i].pos ,obj.vertices[i].normal ,obj.vertices[i].texCoord });
+		}
+		loadObjBufferData(obj);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(3 * sizeof(float)));
+		glEnableVertexAttribArray(1);
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, obj.elements.size() * sizeof(uint32_t), &obj.elements[0], GL_DYNAMIC_DRAW);
+	gpuMemory().buffer(obj.ebo, obj.elements.size() * sizeof(uint32_t));
+	TrackedVector<uint32_t, MEM_MESH>().swap(obj.elements);
+	TrackedVector<RenderVertex, MEM_MESH>().swap(obj.renderData);
+}
+
+// frees the GL buffers of a body that is about to leave the pool
+void releaseObj(Object& obj) {
+	gpuMemory().forget(obj.vbo);
+	gpuMemory().forget(obj.ebo);
+	glDeleteBuffers(1, &obj.vbo);
+	glDeleteBuffers(1, &obj.ebo);
+	glDeleteVertexArrays(1, &obj.vao);
+	obj.vao = obj.vbo = obj.ebo = 0;
+}
+
+Object constructObj(std::string model_path, bool dynamic, float i) {
+	Object obj = prepareObj(model_path, dynamic, i);
+	uploadObj(obj);
+	return obj;
+}
+
+// spawns a copy of a prepared body that was never uploaded, the copy gets its own GL buffers
+PoolHandle spawnObj(ObjectPool<Object>& objects, const Object& prototype, const State& s) {
+	Object obj = prototype;
+	obj.s = s;
+	obj.ps = s;
+	uploadObj(obj);
+	PoolHandle handle = objects.spawn(std::move(obj));
+	objects.get(handle)->handle = handle;
+	return handle;
+}
+
+void despawnObj(ObjectPool<Object>& objects, PairCache& pairs, PoolHandle handle) {
+	Object* obj = objects.get(handle);
+	if (obj == nullptr)
+		return;
+	pairs.forget(handle);
+	releaseObj(*obj);
+	objects.despawn(handle);
 }
 
 void findDerivativeState(State& der, State& s, Object& object) {
@@ -370,14 +457,140 @@ void findDerivativeState(State& der, State& s, Object& object) {
 	
 }
 
-int main() {
+// Dormand-Prince 5(4) tableau, the 5th order weights are the last stage row so the 7th derivative is only used for the error
+const float DP_A[7][6] = {
+	{ 0.0f },
+	{ 1.0f / 5.0f },
+	{ 3.0f / 40.0f, 9.0f / 40.0f },
+	{ 44.0f / 45.0f, -56.0f / 15.0f, 32.0f / 9.0f },
+	{ 19372.0f / 6561.0f, -25360.0f / 2187.0f, 64448.0f / 6561.0f, -212.0f / 729.0f },
+	{ 9017.0f / 3168.0f, -355.0f / 33.0f, 46732.0f / 5247.0f, 49.0f / 176.0f, -5103.0f / 18656.0f },
+	{ 35.0f / 384.0f, 0.0f, 500.0f / 1113.0f, 125.0f / 192.0f, -2187.0f / 6784.0f, 11.0f / 84.0f }
+};
+// difference between the 5th and 4th order weights
+const float DP_E[7] = { 71.0f / 57600.0f, 0.0f, -71.0f / 16695.0f, 71.0f / 1920.0f, -17253.0f / 339200.0f, 22.0f / 525.0f, -1.0f / 40.0f };
+
+// s + h * (c[0] * k[0] + ... + c[n - 1] * k[n - 1])
+State stepState(const State& s, float h, const State* k, const float* c, int n) {
+	State r = s;
+	for (int i = 0; i < n; i++) {
+		r.x += h * c[i] * k[i].x;
+		r.P += h * c[i] * k[i].P;
+		r.L += h * c[i] * k[i].L;
+		r.q += (h * c[i]) * k[i].q;
+	}
+	return r;
+}
+
+float maxAbs(glm::vec3 v) {
+	return glm::max(glm::max(std::fabs(v.x), std::fabs(v.y)), std::fabs(v.z));
+}
+
+// one embedded RK45 step of a body from object.s, returns the local error over the tolerance, <= 1 is acceptable
+float dormandPrinceStep(Object& object, float h, float tolerance, State& next) {
+	State k[7];
+	findDerivativeState(k[0], object.s, object);
+	for (int i = 1; i < 7; i++) {
+		State temp = stepState(object.s, h, k, DP_A[i], i);
+		findDerivativeState(k[i], temp, object);
+	}
+	next = stepState(object.s, h, k, DP_A[6], 6);
+	State zero{ glm::vec3(0.0f), glm::vec3(0.0f), glm::quat(0.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.0f) };
+	State e = stepState(zero, h, k, DP_E, 7);
+	// mixed absolute/relative scale per quantity
+	float err = maxAbs(e.x) / (tolerance * (1.0f + maxAbs(next.x)));
+	err = glm::max(err, maxAbs(e.P) / (tolerance * (1.0f + maxAbs(next.P))));
+	err = glm::max(err, maxAbs(e.L) / (tolerance * (1.0f + maxAbs(next.L))));
+	err = glm::max(err, glm::length(glm::vec4(e.q.x, e.q.y, e.q.z, e.q.w)) / tolerance);
+	return err;
+}
+
+// copies the scene into every world of a batch, body state starts as in objects
+WorldBatch batchFromObjects(const ObjectPool<Object>& objects, size_t worlds, float h) {
+	WorldBatch batch(worlds);
+	for (size_t i = 0; i < objects.size(); i++) {
+		batch.addBody(objects[i].shape, objects[i].m, objects[i].I[0][0], objects[i].dynamic);
+	}
+	for (size_t w = 0; w < worlds; w++) {
+		batch.h[w] = h;
+		for (size_t i = 0; i < objects.size(); i++) {
+			batch.setState(w, i, objects[i].s.x, objects[i].s.P, objects[i].s.q, objects[i].s.L);
+		}
+	}
+	return batch;
+}
+
+// steps a field of sphere debris over a ground plane split into regions, one worker process each
+int runDomainDemo(int regions, int count, int steps) {
+#ifdef DOMAIN_PROCESSES
+	float halfWidth = 25.0f * regions;
+	DomainLayout layout{ -halfWidth, halfWidth, regions };
+	std::vector<DomainStatic> statics;
+	statics.push_back({ makeHalfSpace(glm::vec3(0.0f, 0.0f, 1.0f), 0.0f), glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f) });
+	std::vector<BodyRecord> bodies(count);
+	for (int i = 0; i < count; i++) {
+		BodyRecord& b = bodies[i];
+		b.id = i;
+		b.x = glm::linearRand(glm::vec3(-halfWidth, -25.0f, 1.0f), glm::vec3(halfWidth, 25.0f, 10.0f));
+		b.P = glm::linearRand(glm::vec3(-3.f, -3.f, 0.0f), glm::vec3(3.f, 3.f, 5.0f));
+		b.q = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		b.L = glm::linearRand(glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f));
+		b.push = glm::vec3(0.0f);
+		b.m = 1.0f;
+		b.inertia = 1.0f / 10.0f;
+		b.shape = makeSphere(0.5f);
+		b.dynamic = true;
+	}
+	std::vector<BodyRecord> result;
+	auto start = std::chrono::high_resolution_clock::now();
+	// two radii plus room for 0.5 units of travel per step, far more than these bodies reach at h = 0.01
+	bool ok = runDomains(layout, bodies, statics, 0.01f, steps, 2.0f * 0.5f + 0.5f, result);
+	float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	if (!ok) {
+		std::cout << "Domain workers failed" << std::endl;
+		return -1;
+	}
+	printf("Stepped %zu bodies over %i regions for %i steps in %.1f ms\n", result.size(), regions, steps, ms);
+	return 0;
+#else
+	std::cout << "Domain decomposition needs Linux processes" << std::endl;
+	return -1;
+#endif
+}
+
+int main(int argc, char** argv) {
+	// RBD --domains <regions> <bodies> <steps> runs the multi-process debris demo instead of the viewer
+	if (argc >= 5 && std::strcmp(argv[1], "--domains") == 0)
+		return runDomainDemo(std::atoi(argv[2]), std::atoi(argv[3]), std::atoi(argv[4]));
+
+	// RBD --headless <frames> <output.raw | output prefix> [width height] renders into an offscreen buffer and exits
+	bool headless = false;
+	int headlessFrames = 0;
+	std::string headlessOutput;
+	int windowWidth = 1920;
+	int windowHeight = 1080;
+	if (argc >= 4 && std::strcmp(argv[1], "--headless") == 0) {
+		headless = true;
+		headlessFrames = std::atoi(argv[2]);
+		headlessOutput = argv[3];
+		if (argc >= 6) {
+			windowWidth = std::atoi(argv[4]);
+			windowHeight = std::atoi(argv[5]);
+		}
+		timeToSimulate = true;
+	}
+
+	if (headless)
+		headlessInitHints();
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3); // opengl version 3
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3); //opengil version 3.3
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); //using core profile of opengl
 	//glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	if (headless)
+		headlessWindowHints();
 
-	GLFWwindow* window = glfwCreateWindow(1920, 1080, "RBD", NULL, NULL);
+	GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "RBD", NULL, NULL);
 	//glfwSetWindowMonitor(window, glfwGetPrimaryMonitor(), 0, 0, 1920, 1080, GLFW_DONT_CARE);
 	if (window == NULL)
 	{
@@ -400,24 +613,59 @@ int main() {
 
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-	glViewport(0, 0, 1920, 1080);
+	glViewport(0, 0, windowWidth, windowHeight);
 
-	//load model
-	std::vector<Object> objects;
+	std::unique_ptr<FrameWriter> frameWriter;
+	std::unique_ptr<OffscreenTarget> offscreen;
+	if (headless) {
+		frameWriter.reset(new FrameWriter(headlessOutput, windowWidth, windowHeight));
+		offscreen.reset(new OffscreenTarget(windowWidth, windowHeight, *frameWriter));
+	}
+
+	Shader::cachePath() = "C:\\Src\\shaders\\";
+	Shader shader("C:\\Src\\shaders\\vertRBD.glsl", "C:\\Src\\shaders\\fragRBD.glsl");
+	shader.use();
+	// the bodies are uploaded in whichever vertex format the shader reads
+	packedVertices = usesPackedVertices(shader.ID);
+	if (!packedVertices)
+		printf("vertRBD.glsl has no normalMatrix, drawing float vertices\n");
+
+	//load model, parsing and preprocessing run on the pool and only the buffer creation stays on this thread
+	ObjectPool<Object> objects;
+	// emitted bodies are copies of this one, it keeps its buffer contents since it is never uploaded
+	Object bodyPrototype;
 	bool dynamic = true;
-	objects.push_back(constructObj("C:\\Src\\meshes\\cube.obj", dynamic, 1.0f/6.0f));
-	objects.push_back(constructObj("C:\\Src\\meshes\\cube.obj", dynamic, 1.0f / 6.0f));
-	for (int i = 0; i < 2; i++) {
-		objects.push_back(constructObj("C:\\Src\\meshes\\icos1.obj", dynamic, 1.0f / 10.0f));
-		objects.back().s.x = glm::linearRand(glm::vec3(-10.f,-10.f,1.0f), glm::vec3(10.f, 10.f, 5.0f));
-		objects.back().s.P = glm::linearRand(glm::vec3(-3.f, -3.f, 0.0f), glm::vec3(3.f, 3.f, 5.0f));
-		objects.back().s.q = glm::quat(glm::linearRand(glm::vec4(0.f, 0.f, 0.0f, 0.0f), glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)));
-		objects.back().s.L = glm::linearRand(glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f));
+	{
+		ThreadPool loaders;
+		std::vector<std::future<Object>> pending;
+		pending.push_back(loaders.submit(prepareObj, "C:\\Src\\meshes\\cube.obj", dynamic, 1.0f / 6.0f));
+		pending.push_back(loaders.submit(prepareObj, "C:\\Src\\meshes\\cube.obj", dynamic, 1.0f / 6.0f));
+		for (int i = 0; i < 2; i++) {
+			pending.push_back(loaders.submit(prepareObj, "C:\\Src\\meshes\\icos1.obj", dynamic, 1.0f / 10.0f));
+		}
+		pending.push_back(loaders.submit(prepareObj, "C:\\Src\\meshes\\plane.obj", false, 1.0f));
+		std::future<Object> prototypeLoad = loaders.submit(prepareObj, "C:\\Src\\meshes\\icos1.obj", dynamic, 1.0f / 10.0f);
+		for (size_t i = 0; i < pending.size(); i++) {
+			Object obj = pending[i].get();
+			uploadObj(obj);
+			objects.spawn(std::move(obj));
+		}
+		bodyPrototype = prototypeLoad.get();
+		bodyPrototype.shape = fitSphere(bodyPrototype.vertices);
+	}
+	objects[0].shape = fitBox(objects[0].vertices);
+	objects[1].shape = fitBox(objects[1].vertices);
+	for (int i = 2; i < 4; i++) {
+		objects[i].shape = fitSphere(objects[i].vertices);
+		objects[i].s.x = glm::linearRand(glm::vec3(-10.f,-10.f,1.0f), glm::vec3(10.f, 10.f, 5.0f));
+		objects[i].s.P = glm::linearRand(glm::vec3(-3.f, -3.f, 0.0f), glm::vec3(3.f, 3.f, 5.0f));
+		objects[i].s.q = glm::quat(glm::linearRand(glm::vec4(0.f, 0.f, 0.0f, 0.0f), glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)));
+		objects[i].s.L = glm::linearRand(glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f));
 		//objects.back().s.w = glm::linearRand(glm::vec3(-20.f, -20.f, -20.0f), glm::vec3(20.f, 20.f, 20.0f));
 	}
-	objects.push_back(constructObj("C:\\Src\\meshes\\plane.obj", false, 1.0f));
+	objects[4].shape = makeHalfSpace(glm::vec3(0.0f, 0.0f, 1.0f), objects[4].vertices[0].pos.z);
 	for (int i = 0; i < objects.size(); i++) {
-		objects[i].index = i;
+		objects[i].handle = objects.handleAt(i);
 	}
 	printf("Constructed objects\n");
 	objects[0].s.x = glm::vec3(1.0f, 5.0f, 0.0f);
@@ -434,8 +682,6 @@ int main() {
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 
-	Shader shader("C:\\Src\\shaders\\vertRBD.glsl", "C:\\Src\\shaders\\fragRBD.glsl");
-	shader.use();
 	int width, height;
 
 	glEnable(GL_DEPTH_TEST);
@@ -453,6 +699,44 @@ int main() {
 	float lightPos[3] = {40.0f,30.0f,50.0f};
 	float h = 0.01f;
 	bool rk4 = false;
+	bool adaptive = false;
+	float tolerance = 1e-4f;
+	float hMin = 1e-4f;
+	float hMax = 0.1f;
+	float hAdaptive = h;
+	float contactScale = 0.25f;
+	float simTime = 0.0f;
+	int acceptedSteps = 0;
+	int rejectedSteps = 0;
+	int batchWorlds = 1024;
+	int batchSteps = 500;
+	float batchMs = 0.0f;
+	ThreadPool workers;
+	ParticleSystem particles;
+	particles.materials.push_back({ 1.0f, 0.3f });
+	int spawnCount = 10000;
+	int emitCount = 100;
+	std::deque<PoolHandle> emitted;
+	float stepTaken = h;
+	std::vector<ParticleCollider> colliders;
+	// particles are drawn as points straight from a stream buffer, laid out like VertexData
+	std::vector<VertexData> particleData;
+	unsigned int particleVao, particleVbo;
+	glGenVertexArrays(1, &particleVao);
+	glGenBuffers(1, &particleVbo);
+	glBindVertexArray(particleVao);
+	glBindBuffer(GL_ARRAY_BUFFER, particleVbo);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+	glBindVertexArray(0);
+	size_t stepAllocations[MEM_TAG_COUNT] = {};
+	PairCache pairs;
+	bool pairCaching = true;
+	bool frustumCulling = true;
+	bool meshLod = true;
+	BoundsBatch bounds;
 	while (!glfwWindowShouldClose(window))
 	{
 		// time handling for input, should not interfere with this
@@ -461,6 +745,8 @@ int main() {
 		lastFrame = currentFrame;
 		processInput(window);
 
+		if (offscreen)
+			offscreen->bind();
 		glClearColor(0.7f, .01f, 0.2f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -473,24 +759,98 @@ int main() {
 		shader.setMat4("view", view);
 
 		glfwGetWindowSize(window, &width, &height);
+		if (offscreen) {
+			width = windowWidth;
+			height = windowHeight;
+		}
 
 		glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)width / (float)height, 0.1f, 400.0f);
 		glm::mat4 model = glm::mat4(1.0f);
 
 		shader.setMat4("projection", projection);
 		shader.setMat4("model", model);
+		shader.setMat3("normalMatrix", glm::mat3(1.0f));
 		shader.setVec3("lightPos", lightPos[0], lightPos[1], lightPos[2]);
 		glProvokingVertex(GL_FIRST_VERTEX_CONVENTION);
+		// cull the bounding spheres against the frustum, bodies out of view are not drawn
+		bounds.resize(objects.size());
+		for (size_t i = 0; i < objects.size(); i++) {
+			bounds.x[i] = objects[i].s.x.x;
+			bounds.y[i] = objects[i].s.x.y;
+			bounds.z[i] = objects[i].s.x.z;
+			bounds.r[i] = objects[i].boundRadius;
+		}
+		size_t drawn = objects.size();
+		if (frustumCulling)
+			drawn = cullSpheres(extractFrustum(projection * view), bounds);
 		for (size_t i = 0; i < objects.size(); i++) {
+			if (frustumCulling && !bounds.visible[i])
+				continue;
+			size_t level = meshLod ? selectLod(camPos, objects[i].s.x, objects[i].boundRadius, projection[1][1], objects[i].lods.size()) : 0;
 			glBindVertexArray(objects[i].vao);
-			loadObjBufferData(objects[i]);
-			glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(objects[i].indices.size()), GL_UNSIGNED_INT, 0);
+			if (packedVertices) {
+				// the vertex buffer stays in mesh space, the body transform goes through the model matrix and the
+				// normals through the rotation alone, see vertexformat.h for what the shader does with them
+				shader.setMat4("model", glm::translate(glm::mat4(1.0f), objects[i].s.x) * glm::toMat4(objects[i].s.q) * objects[i].meshToLocal);
+				shader.setMat3("normalMatrix", glm::toMat3(objects[i].s.q));
+			}
+			else {
+				glm::mat3 R = glm::toMat3(objects[i].s.q);
+				for (size_t j = 0; j < objects[i].vertices.size(); j++) {
+					objects[i].drawData[j].pos = objects[i].s.x + R * objects[i].vertices[j].pos;
+					objects[i].drawData[j].normal = R * objects[i].vertices[j].normal;
+				}
+				loadObjBufferData(objects[i]);
+			}
+			glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(objects[i].lods[level].count), GL_UNSIGNED_INT, (void*)(objects[i].lods[level].first * sizeof(uint32_t)));
+		}
+		if (particles.size() > 0) {
+			particleData.resize(particles.size());
+			for (size_t i = 0; i < particles.size(); i++) {
+				particleData[i] = { particles.x[i], glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(0.0f) };
+			}
+			shader.setMat4("model", model);
+			shader.setMat3("normalMatrix", glm::mat3(1.0f));
+			glBindVertexArray(particleVao);
+			glBindBuffer(GL_ARRAY_BUFFER, particleVbo);
+			glBufferData(GL_ARRAY_BUFFER, particleData.size() * sizeof(VertexData), &particleData[0], GL_STREAM_DRAW);
+			gpuMemory().buffer(particleVbo, particleData.size() * sizeof(VertexData));
+			glPointSize(3.0f);
+			glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(particleData.size()));
 		}
 		if (timeToSimulate) {
+			MemSnapshot stepStart = memSnapshot();
 			// integrate 
 			State change{};
+			if (adaptive) {
+				// one shared step for every body, retried smaller until all of them meet the tolerance
+				std::vector<State> next(objects.size());
+				float err;
+				while (true) {
+					err = 0.0f;
+					for (size_t i = 0; i < objects.size(); i++) {
+						if (objects[i].dynamic)
+							err = glm::max(err, dormandPrinceStep(objects[i], hAdaptive, tolerance, next[i]));
+					}
+					if (err <= 1.0f || hAdaptive <= hMin)
+						break;
+					hAdaptive = glm::max(hMin, hAdaptive * glm::max(0.2f, 0.9f * std::pow(err, -0.2f)));
+					rejectedSteps++;
+				}
+				stepTaken = hAdaptive;
+				for (size_t i = 0; i < objects.size(); i++) {
+					if (objects[i].dynamic) {
+						objects[i].impulses.clear();
+						objects[i].s = next[i];
+						objects[i].s.q = glm::normalize(objects[i].s.q);
+					}
+				}
+				simTime += hAdaptive;
+				acceptedSteps++;
+				hAdaptive = glm::min(hMax, hAdaptive * (err > 0.0f ? glm::min(5.0f, 0.9f * std::pow(err, -0.2f)) : 5.0f));
+			}
 			for (size_t i = 0; i < objects.size(); i++) {
-				if (objects[i].dynamic) {
+				if (objects[i].dynamic && !adaptive) {
 					// calculate forces
 
 					State tempState{};
@@ -588,9 +948,34 @@ int main() {
 					
 				}
 			}
+			// age the cached pair gaps by how far each body can have moved since the previous step
+			pairs.resetCounts();
+			if (pairCaching) {
+				for (size_t i = 0; i < objects.size(); i++) {
+					if (objects[i].dynamic)
+						pairs.moved(objects[i].handle, motionBound(objects[i].ps.x, objects[i].ps.q, objects[i].s.x, objects[i].s.q, shapeRadius(objects[i].shape, objects[i].boundRadius)));
+				}
+			}
 			// find the collisions
 			for (size_t i = 0; i < objects.size(); i++) {
 				for (size_t j = i + 1; j < objects.size(); j++) {
+					ShapePose poseI = makePose(objects[i].s.x, objects[i].s.q);
+					ShapePose poseJ = makePose(objects[j].s.x, objects[j].s.q);
+					if (pairCaching && pairs.separated(objects[i].handle, objects[i].shape, poseI, objects[i].boundRadius, objects[j].handle, objects[j].shape, poseJ, objects[j].boundRadius))
+						continue;
+					// closed form contacts when both bodies have an analytic shape, the normal is flipped to point
+					// from j towards i like the face normals below
+					ShapeContact contacts[MAX_SHAPE_CONTACTS];
+					int contactCount = collideShapes(objects[i].shape, poseI, objects[j].shape, poseJ, contacts);
+					if (contactCount >= 0) {
+						for (int c = 0; c < contactCount; c++) {
+							TrackedVector<glm::vec3, MEM_CONTACTS> points;
+							points.push_back(contacts[c].point);
+							objects[i].impulses.push_back({ contacts[c].point, -contacts[c].normal, points });
+							objects[j].impulses.push_back({ contacts[c].point, -contacts[c].normal, points });
+						}
+						continue;
+					}
 					// vertex face
 					for (Face f : objects[j].faces) {
 						//printf("before norm\n");
@@ -601,12 +986,12 @@ int main() {
 						glm::vec3 v3 = objects[j].s.x + glm::toMat3(objects[j].s.q) * objects[j].vertices[f.v3].pos;
 						//printf("after faces\n");
 
-						glm::vec3 v1_prev = objects[j].drawData[f.v1].pos;
-						glm::vec3 v2_prev = objects[j].drawData[f.v2].pos;
-						glm::vec3 v3_prev = objects[j].drawData[f.v3].pos;
+						glm::vec3 v1_prev = objects[j].ps.x + glm::toMat3(objects[j].ps.q) * objects[j].vertices[f.v1].pos;
+						glm::vec3 v2_prev = objects[j].ps.x + glm::toMat3(objects[j].ps.q) * objects[j].vertices[f.v2].pos;
+						glm::vec3 v3_prev = objects[j].ps.x + glm::toMat3(objects[j].ps.q) * objects[j].vertices[f.v3].pos;
 						for (size_t k = 0; k < objects[i].vertices.size(); k++) {
 							glm::vec3 v = objects[i].s.x + glm::toMat3(objects[i].s.q) * objects[i].vertices[k].pos;
-							glm::vec3 v_prev = objects[i].drawData[k].pos;
+							glm::vec3 v_prev = objects[i].ps.x + glm::toMat3(objects[i].ps.q) * objects[i].vertices[k].pos;
 							float side1 = glm::dot(v - v1, norm);
 							float side2 = glm::dot(v_prev - v1_prev, norm);
 							if (signbit(side1) != signbit(side2)) {
@@ -619,7 +1004,7 @@ int main() {
 									if (signbit(s1) == signbit(s2) && signbit(s2) == signbit(s3)) {
 										//inside the polygon, mark intersection
 										glm::vec3 p = v + glm::dot(v - v1, norm) * norm;
-										std::vector<glm::vec3> points;
+										TrackedVector<glm::vec3, MEM_CONTACTS> points;
 										points.push_back(v);
 										objects[i].impulses.push_back({ p, norm, points });
 										points.clear();
@@ -636,7 +1021,7 @@ int main() {
 									float s3 = (v1.x - v3.x) * (v.z - v3.z) - (v1.z - v3.z) * (v.x - v3.x);
 									if (signbit(s1) == signbit(s2) && signbit(s2) == signbit(s3)) {
 										glm::vec3 p = v+glm::dot(v - v1, norm)*norm;
-										std::vector<glm::vec3> points;
+										TrackedVector<glm::vec3, MEM_CONTACTS> points;
 										points.push_back(v);
 										objects[i].impulses.push_back({ p, norm, points });
 										points.clear();
@@ -653,7 +1038,7 @@ int main() {
 									float s3 = (v1.x - v3.x) * (v.y - v3.y) - (v1.y - v3.y) * (v.x - v3.x);
 									if (signbit(s1) == signbit(s2) && signbit(s2) == signbit(s3)) {
 										glm::vec3 p = v + glm::dot(v - v1, norm) * norm;
-										std::vector<glm::vec3> points;
+										TrackedVector<glm::vec3, MEM_CONTACTS> points;
 										points.push_back(v);
 										objects[i].impulses.push_back({ p, norm, points});
 										points.clear();
@@ -701,7 +1086,9 @@ int main() {
 			}
 			
 			//handle the collision
+			bool contact = false;
 			for (size_t i = 0; i < objects.size(); i++) {
+				contact = contact || !objects[i].impulses.empty();
 				for (int j = 0; j < objects[i].impulses.size(); j++) {
 					for (int k = 0; k < objects[i].impulses[j].points.size(); k++) {
 						//printf("This amount of points in this impulse: %i, %i, %i\n", i, j, k);
@@ -716,18 +1103,26 @@ int main() {
 				}
 				objects[i].ps = objects[i].s;
 			}
-			
-		}
-
-		//update the positions
-		for (size_t i = 0; i < objects.size(); i++) {
-			for (size_t j = 0; j < objects[i].vertices.size(); j++) {
-				objects[i].drawData[j].pos = objects[i].s.x + glm::toMat3(objects[i].s.q) * objects[i].vertices[j].pos;
-				objects[i].drawData[j].normal = glm::toMat3(objects[i].s.q) * objects[i].vertices[j].normal; 
-				//printf("Vertices of vertex %i: (%f, %f, %f)\n", j, objects[i].vertices[j].pos.x, objects[i].vertices[j].pos.y, objects[i].vertices[j].pos.z);
+			// resolve the steps around a contact finely, the controller grows the step back once it is over
+			if (adaptive && contact)
+				hAdaptive = glm::max(hMin, hAdaptive * contactScale);
+			if (!adaptive) {
+				simTime += h;
+				acceptedSteps++;
+				stepTaken = h;
+			}
+			// particles see the rigid bodies after their impulses, mesh-only bodies are skipped by collideShapes
+			colliders.clear();
+			for (size_t i = 0; i < objects.size(); i++) {
+				colliders.push_back({ objects[i].shape, makePose(objects[i].s.x, objects[i].s.q), &objects[i].s.P, &objects[i].s.L, objects[i].m, objects[i].I[0][0], objects[i].dynamic });
+			}
+			particles.step(stepTaken, colliders);
+			MemSnapshot stepEnd = memSnapshot();
+			for (int t = 0; t < MEM_TAG_COUNT; t++) {
+				stepAllocations[t] = stepEnd.allocations[t] - stepStart.allocations[t];
 			}
 		}
-		
+
 		ImGui::Begin("Simulation Settings");
 		if (ImGui::Button("Start Simulation")) {
 			timeToSimulate = true;
@@ -736,15 +1131,97 @@ int main() {
 		if (ImGui::Button("Stop Simulation")) {
 			timeToSimulate = false;
 		}
+		// travel is not tracked while the cache is off, so its entries cannot be trusted afterwards
+		if (ImGui::Checkbox("Pair Cache", &pairCaching)) {
+			pairs.clear();
+		}
+		ImGui::Text("Pairs skipped %i, refreshed %i, tested %i", pairs.skipped, pairs.refreshed, pairs.tested);
 		ImGui::End();
 
 		ImGui::Begin("Integrator Settings");
 		ImGui::Checkbox("Use RK4", &rk4);
 		ImGui::DragFloat("Time Step", &h, 0.001);
+		ImGui::Checkbox("Adaptive RK45", &adaptive);
+		ImGui::DragFloat("Tolerance", &tolerance, 1e-5f, 1e-7f, 1.0f, "%.7f");
+		ImGui::DragFloat("Min Step", &hMin, 1e-5f, 1e-6f, hMax, "%.5f");
+		ImGui::DragFloat("Max Step", &hMax, 0.001f, hMin, 1.0f);
+		ImGui::DragFloat("Contact Step Scale", &contactScale, 0.01f, 0.01f, 1.0f);
+		ImGui::Text("Step %.5f, t = %.3f", adaptive ? hAdaptive : h, simTime);
+		ImGui::Text("Steps %i accepted, %i rejected", acceptedSteps, rejectedSteps);
+		ImGui::End();
+
+		ImGui::Begin("Batch Settings");
+		ImGui::DragInt("Worlds", &batchWorlds, 1.0f, 1, 1 << 20);
+		ImGui::DragInt("Steps", &batchSteps, 1.0f, 1, 100000);
+		if (ImGui::Button("Run Batch")) {
+			// every world starts from the current scene with jittered momenta
+			WorldBatch batch = batchFromObjects(objects, batchWorlds, h);
+			for (size_t w = 0; w < batch.worldCount(); w++) {
+				for (size_t i = 0; i < objects.size(); i++) {
+					if (objects[i].dynamic) {
+						glm::vec3 P = objects[i].s.P + glm::linearRand(glm::vec3(-1.0f), glm::vec3(1.0f));
+						glm::vec3 L = objects[i].s.L + glm::linearRand(glm::vec3(-0.1f), glm::vec3(0.1f));
+						batch.setState(w, i, objects[i].s.x, P, objects[i].s.q, L);
+					}
+				}
+			}
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int k = 0; k < batchSteps; k++) {
+				batch.step(&workers);
+			}
+			batchMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+		ImGui::Text("Last batch: %.1f ms, %.0f world steps/s", batchMs, batchMs > 0.0f ? batchWorlds * batchSteps * 1000.0f / batchMs : 0.0f);
+		ImGui::End();
+
+		ImGui::Begin("Body Emitter");
+		ImGui::DragInt("Bodies", &emitCount, 1.0f, 1, 10000);
+		if (ImGui::Button("Spawn Bodies")) {
+			for (int i = 0; i < emitCount; i++) {
+				State s;
+				s.x = glm::linearRand(glm::vec3(-10.f, -10.f, 1.0f), glm::vec3(10.f, 10.f, 10.0f));
+				s.P = glm::linearRand(glm::vec3(-3.f, -3.f, 0.0f), glm::vec3(3.f, 3.f, 5.0f));
+				s.q = glm::normalize(glm::quat(glm::linearRand(glm::vec4(0.f, 0.f, 0.0f, 0.0f), glm::vec4(1.0f, 1.0f, 1.0f, 1.0f))));
+				s.L = glm::linearRand(glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f));
+				emitted.push_back(spawnObj(objects, bodyPrototype, s));
+			}
+		}
+		if (ImGui::Button("Despawn Oldest")) {
+			for (int i = 0; i < emitCount && !emitted.empty(); i++) {
+				despawnObj(objects, pairs, emitted.front());
+				emitted.pop_front();
+			}
+		}
+		ImGui::Text("Emitted %i, bodies %i", static_cast<int>(emitted.size()), static_cast<int>(objects.size()));
+		ImGui::End();
+
+		ImGui::Begin("Particle Settings");
+		ImGui::DragInt("Spawn Count", &spawnCount, 100.0f, 1, 1000000);
+		if (ImGui::Button("Spawn Debris")) {
+			for (int i = 0; i < spawnCount; i++) {
+				particles.add(glm::linearRand(glm::vec3(-10.f, -10.f, 1.0f), glm::vec3(10.f, 10.f, 10.0f)), glm::vec3(0.0f), glm::linearRand(0.03f, 0.08f), 0);
+			}
+		}
+		if (ImGui::Button("Clear Debris")) {
+			particles.clear();
+		}
+		ImGui::Text("Particles %i", static_cast<int>(particles.size()));
 		ImGui::End();
 
 		ImGui::Begin("Render Settings");
 		ImGui::DragFloat3("Light Pos", lightPos, 0.1f);
+		ImGui::Checkbox("Frustum Culling", &frustumCulling);
+		ImGui::Checkbox("Mesh LOD", &meshLod);
+		ImGui::Text("Drawn %i / %i", static_cast<int>(drawn), static_cast<int>(objects.size()));
+		ImGui::End();
+
+		ImGui::Begin("Memory");
+		MemSnapshot mem = memSnapshot();
+		ImGui::Text("%-10s %10s %10s %12s", "", "live KB", "peak KB", "allocs/step");
+		for (int t = 0; t < MEM_TAG_COUNT; t++) {
+			ImGui::Text("%-10s %10.1f %10.1f %12i", MEM_TAG_NAMES[t], mem.live[t] / 1024.0f, mem.peak[t] / 1024.0f, static_cast<int>(stepAllocations[t]));
+		}
+		ImGui::Text("GL buffers %i", static_cast<int>(gpuMemory().buffers()));
 		ImGui::End();
 
 		ImGui::Begin("Outliner");
@@ -756,12 +1233,25 @@ int main() {
 			ImGui::UpdatePlatformWindows();
 			ImGui::RenderPlatformWindowsDefault();
 		}
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-
-		glfwSwapBuffers(window);
+		if (offscreen) {
+			// the panels stay out of the recorded frames
+			offscreen->capture();
+			if (offscreen->capturedFrames() >= headlessFrames)
+				glfwSetWindowShouldClose(window, true);
+		}
+		else {
+			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+			glfwSwapBuffers(window);
+		}
 		glfwPollEvents();
 	}
 
+	// drain the readbacks and let the writer finish while the context is still alive
+	offscreen.reset();
+	frameWriter.reset();
+	if (headless)
+		printMemReport(stdout, stepAllocations);
+
 
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
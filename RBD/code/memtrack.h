@@ -0,0 +1,156 @@
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+// subsystems memory is accounted to, GPU is the size of the GL buffers rather than host allocations
+enum MemTag {
+	MEM_MESH,
+	MEM_TOPOLOGY,
+	MEM_CONTACTS,
+	MEM_GPU,
+	MEM_TAG_COUNT
+};
+
+const char* const MEM_TAG_NAMES[MEM_TAG_COUNT] = { "Mesh", "Topology", "Contacts", "GPU" };
+
+struct MemCounter {
+	std::atomic<size_t> live{ 0 };
+	std::atomic<size_t> peak{ 0 };
+	std::atomic<size_t> allocations{ 0 };
+};
+
+inline MemCounter& memCounter(MemTag tag) {
+	static MemCounter counters[MEM_TAG_COUNT];
+	return counters[tag];
+}
+
+// allocators of every thread report here, the loaders allocate meshes on the pool
+inline void memAllocated(MemTag tag, size_t bytes) {
+	MemCounter& c = memCounter(tag);
+	size_t live = c.live.fetch_add(bytes) + bytes;
+	size_t peak = c.peak.load();
+	while (live > peak && !c.peak.compare_exchange_weak(peak, live)) {
+	}
+	c.allocations++;
+}
+
+inline void memFreed(MemTag tag, size_t bytes) {
+	memCounter(tag).live -= bytes;
+}
+
+// std allocator that books its memory under Tag, containers of one tag share the counters
+template<typename T, MemTag Tag>
+struct TaggedAllocator {
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind {
+		typedef TaggedAllocator<U, Tag> other;
+	};
+
+	TaggedAllocator() = default;
+
+	template<typename U>
+	TaggedAllocator(const TaggedAllocator<U, Tag>&) {
+	}
+
+	T* allocate(size_t n) {
+		T* p = static_cast<T*>(::operator new(n * sizeof(T)));
+		memAllocated(Tag, n * sizeof(T));
+		return p;
+	}
+
+	void deallocate(T* p, size_t n) {
+		memFreed(Tag, n * sizeof(T));
+		::operator delete(p);
+	}
+};
+
+template<typename T, typename U, MemTag Tag>
+bool operator==(const TaggedAllocator<T, Tag>&, const TaggedAllocator<U, Tag>&) {
+	return true;
+}
+
+template<typename T, typename U, MemTag Tag>
+bool operator!=(const TaggedAllocator<T, Tag>&, const TaggedAllocator<U, Tag>&) {
+	return false;
+}
+
+template<typename T, MemTag Tag>
+using TrackedVector = std::vector<T, TaggedAllocator<T, Tag>>;
+
+// sizes of the live GL buffers by name. glBufferData on a tracked buffer replaces its size, so re-uploading
+// every frame does not count as growth, a buffer deleted without forgetting it shows up as a leak
+class GpuMemory
+{
+public:
+	void buffer(unsigned int name, size_t bytes) {
+		std::lock_guard<std::mutex> lock(mutex);
+		size_t& size = sizes[name];
+		if (size != bytes) {
+			if (size != 0)
+				memFreed(MEM_GPU, size);
+			memAllocated(MEM_GPU, bytes);
+			size = bytes;
+		}
+	}
+
+	void forget(unsigned int name) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = sizes.find(name);
+		if (it == sizes.end())
+			return;
+		memFreed(MEM_GPU, it->second);
+		sizes.erase(it);
+	}
+
+	size_t buffers() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return sizes.size();
+	}
+
+private:
+	std::mutex mutex;
+	std::unordered_map<unsigned int, size_t> sizes;
+};
+
+inline GpuMemory& gpuMemory() {
+	static GpuMemory memory;
+	return memory;
+}
+
+// counter values at one point in time, the difference of two gives the allocations made in between
+struct MemSnapshot {
+	size_t live[MEM_TAG_COUNT];
+	size_t peak[MEM_TAG_COUNT];
+	size_t allocations[MEM_TAG_COUNT];
+};
+
+inline MemSnapshot memSnapshot() {
+	MemSnapshot s;
+	for (int t = 0; t < MEM_TAG_COUNT; t++) {
+		MemCounter& c = memCounter(static_cast<MemTag>(t));
+		s.live[t] = c.live.load();
+		s.peak[t] = c.peak.load();
+		s.allocations[t] = c.allocations.load();
+	}
+	return s;
+}
+
+// one line per subsystem, used by the headless runner
+inline void printMemReport(std::FILE* out, const size_t* allocationsPerStep) {
+	std::fprintf(out, "%-10s %14s %14s %12s\n", "subsystem", "live bytes", "peak bytes", "allocs/step");
+	MemSnapshot s = memSnapshot();
+	for (int t = 0; t < MEM_TAG_COUNT; t++) {
+		std::fprintf(out, "%-10s %14zu %14zu %12zu\n", MEM_TAG_NAMES[t], s.live[t], s.peak[t], allocationsPerStep[t]);
+	}
+}
+
+#endif
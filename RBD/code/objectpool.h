@@ -0,0 +1,136 @@
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// refers to a pooled item across spawns and despawns. The generation tells a handle to a despawned item
+// apart from the item that reused its slot, a default handle never refers to anything
+struct PoolHandle {
+	uint32_t slot = 0;
+	uint32_t generation = 0;
+
+	bool operator==(const PoolHandle& other) const {
+		return slot == other.slot && generation == other.generation;
+	}
+	bool operator!=(const PoolHandle& other) const {
+		return !(*this == other);
+	}
+};
+
+// items stay packed in one vector for iteration, removal moves the last item into the hole. Handles go through
+// a slot table to the packed position so they stay valid while items move, freed slots are reused first
+template<typename T>
+class ObjectPool
+{
+	// growing the vector has to move the items, a throwing move would make it deep copy every mesh instead
+	static_assert(std::is_nothrow_move_constructible<T>::value, "pooled items must be nothrow movable");
+
+public:
+	PoolHandle spawn(T&& value) {
+		uint32_t slot;
+		if (!freeSlots.empty()) {
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else {
+			slot = static_cast<uint32_t>(slots.size());
+			slots.push_back({ 0, 1 });
+		}
+		slots[slot].packed = static_cast<uint32_t>(items.size());
+		items.push_back(std::move(value));
+		owners.push_back(slot);
+		return { slot, slots[slot].generation };
+	}
+
+	// returns false for a stale handle, the item is destroyed so anything it owns outside the pool has to be released first
+	bool despawn(PoolHandle handle) {
+		if (!alive(handle))
+			return false;
+		uint32_t hole = slots[handle.slot].packed;
+		uint32_t last = static_cast<uint32_t>(items.size() - 1);
+		if (hole != last) {
+			items[hole] = std::move(items[last]);
+			owners[hole] = owners[last];
+			slots[owners[hole]].packed = hole;
+		}
+		items.pop_back();
+		owners.pop_back();
+		slots[handle.slot].generation++;
+		freeSlots.push_back(handle.slot);
+		return true;
+	}
+
+	bool alive(PoolHandle handle) const {
+		return handle.slot < slots.size() && slots[handle.slot].generation == handle.generation;
+	}
+
+	// nullptr once the item is gone, the pointer is only good until the next spawn or despawn
+	T* get(PoolHandle handle) {
+		return alive(handle) ? &items[slots[handle.slot].packed] : nullptr;
+	}
+
+	const T* get(PoolHandle handle) const {
+		return alive(handle) ? &items[slots[handle.slot].packed] : nullptr;
+	}
+
+	// handle of the item at a packed position
+	PoolHandle handleAt(size_t i) const {
+		return { owners[i], slots[owners[i]].generation };
+	}
+
+	void reserve(size_t count) {
+		items.reserve(count);
+		owners.reserve(count);
+		slots.reserve(count);
+	}
+
+	size_t size() const {
+		return items.size();
+	}
+
+	bool empty() const {
+		return items.empty();
+	}
+
+	// packed positions change on despawn, use a handle to keep hold of an item
+	T& operator[](size_t i) {
+		return items[i];
+	}
+
+	const T& operator[](size_t i) const {
+		return items[i];
+	}
+
+	typename std::vector<T>::iterator begin() {
+		return items.begin();
+	}
+
+	typename std::vector<T>::iterator end() {
+		return items.end();
+	}
+
+	typename std::vector<T>::const_iterator begin() const {
+		return items.begin();
+	}
+
+	typename std::vector<T>::const_iterator end() const {
+		return items.end();
+	}
+
+private:
+	struct Slot {
+		uint32_t packed;
+		uint32_t generation;
+	};
+	std::vector<T> items;
+	// slot of the item at each packed position
+	std::vector<uint32_t> owners;
+	std::vector<Slot> slots;
+	std::vector<uint32_t> freeSlots;
+};
+
+#endif
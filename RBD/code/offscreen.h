@@ -0,0 +1,234 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// GLFW setup for running without a visible window, call before glfwInit. On Linux without a display
+// the null platform with an OSMesa context is used so Mesa's software rasterizer can render
+inline void headlessInitHints() {
+#if defined(GLFW_PLATFORM_NULL) && !defined(_WIN32)
+	if (std::getenv("DISPLAY") == nullptr && std::getenv("WAYLAND_DISPLAY") == nullptr)
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
+}
+
+// window hints for the hidden context, call after glfwInit and before glfwCreateWindow
+inline void headlessWindowHints() {
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#if defined(GLFW_PLATFORM_NULL) && !defined(_WIN32)
+	if (glfwGetPlatform() == GLFW_PLATFORM_NULL)
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+}
+
+// writes finished frames on its own thread so encoding overlaps with simulating the next frames.
+// a path ending in .raw gets every frame appended as top-down RGBA, anything else is a prefix for a PPM sequence
+class FrameWriter
+{
+public:
+	FrameWriter(const std::string& path, int width, int height) : path(path), width(width), height(height) {
+		raw = path.size() >= 4 && path.compare(path.size() - 4, 4, ".raw") == 0;
+		if (raw) {
+			rawFile = std::fopen(path.c_str(), "wb");
+			if (rawFile == nullptr)
+				std::cout << "ERROR::FRAMEWRITER::FILE_NOT_WRITABLE: " << path << std::endl;
+		}
+		worker = std::thread([this] { run(); });
+	}
+
+	// writes out everything still queued
+	~FrameWriter() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+		if (rawFile != nullptr)
+			std::fclose(rawFile);
+	}
+
+	FrameWriter(const FrameWriter&) = delete;
+	FrameWriter& operator=(const FrameWriter&) = delete;
+
+	// takes bottom-up RGBA rows straight from glReadPixels, blocks only when the writer falls far behind
+	void push(std::vector<unsigned char>&& pixels) {
+		std::unique_lock<std::mutex> lock(mutex);
+		space.wait(lock, [this] { return frames.size() < MAX_QUEUED; });
+		frames.push_back(std::move(pixels));
+		wake.notify_one();
+	}
+
+private:
+	static const size_t MAX_QUEUED = 16;
+	std::string path;
+	int width, height;
+	bool raw;
+	std::FILE* rawFile = nullptr;
+	int written = 0;
+	std::deque<std::vector<unsigned char>> frames;
+	std::mutex mutex;
+	std::condition_variable wake, space;
+	bool stopping = false;
+	std::thread worker;
+
+	void run() {
+		while (true) {
+			std::vector<unsigned char> pixels;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !frames.empty(); });
+				if (frames.empty())
+					return;
+				pixels = std::move(frames.front());
+				frames.pop_front();
+			}
+			space.notify_one();
+			write(pixels);
+		}
+	}
+
+	void write(const std::vector<unsigned char>& pixels) {
+		size_t stride = static_cast<size_t>(width) * 4;
+		if (raw) {
+			if (rawFile == nullptr)
+				return;
+			for (int y = height - 1; y >= 0; y--)
+				std::fwrite(&pixels[y * stride], 1, stride, rawFile);
+		}
+		else {
+			char name[32];
+			std::snprintf(name, sizeof(name), "%05d.ppm", written);
+			std::FILE* file = std::fopen((path + name).c_str(), "wb");
+			if (file == nullptr) {
+				std::cout << "ERROR::FRAMEWRITER::FILE_NOT_WRITABLE: " << path + name << std::endl;
+				return;
+			}
+			std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+			std::vector<unsigned char> row(static_cast<size_t>(width) * 3);
+			for (int y = height - 1; y >= 0; y--) {
+				for (int x = 0; x < width; x++)
+					std::memcpy(&row[x * 3], &pixels[y * stride + x * 4], 3);
+				std::fwrite(row.data(), 1, row.size(), file);
+			}
+			std::fclose(file);
+		}
+		written++;
+	}
+};
+
+// framebuffer object the scene is drawn into, read back through a ring of pixel buffers so glReadPixels
+// only queues a copy and the frame is mapped a few frames later once its fence has signalled
+class OffscreenTarget
+{
+public:
+	static const int RING = 3;
+
+	OffscreenTarget(int width, int height, FrameWriter& writer) : width(width), height(height), writer(writer) {
+		glGenFramebuffers(1, &fbo);
+		glGenRenderbuffers(1, &color);
+		glGenRenderbuffers(1, &depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::OFFSCREEN::FRAMEBUFFER_INCOMPLETE" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		glGenBuffers(RING, pbos);
+		for (int i = 0; i < RING; i++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes(), NULL, GL_STREAM_READ);
+			fences[i] = 0;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	~OffscreenTarget() {
+		finish();
+		glDeleteBuffers(RING, pbos);
+		glDeleteRenderbuffers(1, &color);
+		glDeleteRenderbuffers(1, &depth);
+		glDeleteFramebuffers(1, &fbo);
+	}
+
+	OffscreenTarget(const OffscreenTarget&) = delete;
+	OffscreenTarget& operator=(const OffscreenTarget&) = delete;
+
+	void bind() {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, width, height);
+	}
+
+	// queues the readback of the current frame, handing the oldest one in flight to the writer when the ring is full
+	void capture() {
+		int slot = frame % RING;
+		if (fences[slot] != 0)
+			collect(slot);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		frame++;
+	}
+
+	// drains every readback still in flight, oldest first
+	void finish() {
+		for (int i = 0; i < RING; i++) {
+			int slot = (frame + i) % RING;
+			if (fences[slot] != 0)
+				collect(slot);
+		}
+	}
+
+	int capturedFrames() const {
+		return frame;
+	}
+
+private:
+	int width, height;
+	FrameWriter& writer;
+	unsigned int fbo = 0, color = 0, depth = 0;
+	unsigned int pbos[RING];
+	GLsync fences[RING];
+	int frame = 0;
+
+	size_t frameBytes() const {
+		return static_cast<size_t>(width) * height * 4;
+	}
+
+	void collect(int slot) {
+		glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+		glDeleteSync(fences[slot]);
+		fences[slot] = 0;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+		const unsigned char* mapped = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameBytes(), GL_MAP_READ_BIT));
+		if (mapped != nullptr) {
+			std::vector<unsigned char> pixels(mapped, mapped + frameBytes());
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			writer.push(std::move(pixels));
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+};
+
+#endif
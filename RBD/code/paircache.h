@@ -0,0 +1,223 @@
+#ifndef PAIRCACHE_H
+#define PAIRCACHE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "objectpool.h"
+#include "shapes.h"
+
+// how far any point within radius of the body origin can have moved between two states
+inline float motionBound(glm::vec3 x0, glm::quat q0, glm::vec3 x1, glm::quat q1, float radius) {
+	float n = glm::length(q0) * glm::length(q1);
+	float turn = 2.0f * radius;
+	if (n > 1e-12f) {
+		float c = glm::min(std::fabs(glm::dot(q0, q1)) / n, 1.0f);
+		// the chord a point sweeps is shorter than its arc, and never longer than the diameter
+		turn = glm::min(turn, 2.0f * std::acos(c) * radius);
+	}
+	return glm::length(x1 - x0) + turn;
+}
+
+// radius around the body origin that holds the shape, mesh shapes use the radius of their vertices
+inline float shapeRadius(const Shape& shape, float boundRadius) {
+	switch (shape.type) {
+	case SHAPE_SPHERE:
+		return glm::max(boundRadius, shape.radius);
+	case SHAPE_BOX:
+		return glm::max(boundRadius, glm::length(shape.halfExtents));
+	case SHAPE_CAPSULE:
+		return glm::max(boundRadius, shape.halfHeight + shape.radius);
+	default:
+		return boundRadius;
+	}
+}
+
+// half width of the shape's projection onto a unit axis, mesh shapes use their bounding sphere
+inline float supportExtent(const Shape& shape, const ShapePose& pose, float boundRadius, glm::vec3 axis) {
+	switch (shape.type) {
+	case SHAPE_SPHERE:
+		return shape.radius;
+	case SHAPE_BOX:
+		return std::fabs(glm::dot(axis, pose.R[0])) * shape.halfExtents.x
+			+ std::fabs(glm::dot(axis, pose.R[1])) * shape.halfExtents.y
+			+ std::fabs(glm::dot(axis, pose.R[2])) * shape.halfExtents.z;
+	case SHAPE_CAPSULE:
+		return std::fabs(glm::dot(axis, pose.R[2])) * shape.halfHeight + shape.radius;
+	default:
+		return boundRadius;
+	}
+}
+
+// distance between the projections of a and b onto a unit axis pointing from a towards b,
+// positive means axis separates them by at least that much
+inline float gapAlong(const Shape& a, const ShapePose& pa, float ra, const Shape& b, const ShapePose& pb, float rb, glm::vec3 axis) {
+	if (a.type == SHAPE_HALFSPACE && b.type == SHAPE_HALFSPACE)
+		return -1.0f;
+	if (a.type == SHAPE_HALFSPACE) {
+		glm::vec3 n = pa.R * a.normal;
+		if (glm::dot(n, axis) < 0.999f)
+			return -1.0f;
+		return glm::dot(n, pb.x - pa.x) - a.offset - supportExtent(b, pb, rb, n);
+	}
+	if (b.type == SHAPE_HALFSPACE) {
+		glm::vec3 n = pb.R * b.normal;
+		if (glm::dot(n, axis) > -0.999f)
+			return -1.0f;
+		return glm::dot(n, pa.x - pb.x) - b.offset - supportExtent(a, pa, ra, n);
+	}
+	return glm::dot(axis, pb.x - pa.x) - supportExtent(a, pa, ra, axis) - supportExtent(b, pb, rb, axis);
+}
+
+// axis to try first when nothing is cached, the half-space normal or the line between the origins
+inline glm::vec3 candidateAxis(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb) {
+	if (a.type == SHAPE_HALFSPACE)
+		return pa.R * a.normal;
+	if (b.type == SHAPE_HALFSPACE)
+		return -(pb.R * b.normal);
+	glm::vec3 d = pb.x - pa.x;
+	float len = glm::length(d);
+	return len > 1e-6f ? d / len : glm::vec3(0.0f, 0.0f, 1.0f);
+}
+
+// remembers for each pair of bodies an axis that separated them and by how much. Every body accumulates the
+// distance it may have travelled, a pair is skipped while the travel of both since the entry was written is
+// below the gap, so a skipped pair costs one lookup and a compare. Expired entries are first re-checked along
+// the cached axis and the current candidate axis before the caller falls back to the narrow phase
+class PairCache
+{
+public:
+	// adds this step's motion bound of a body, dynamic bodies have to be reported every step and static ones never
+	void moved(PoolHandle body, float distance) {
+		if (body.slot >= travel.size()) {
+			travel.resize(body.slot + 1, 0.0);
+			lastStep.resize(body.slot + 1, 0.0f);
+		}
+		travel[body.slot] += distance;
+		lastStep[body.slot] = distance;
+	}
+
+	// true when a and b cannot touch this step and the narrow phase can be skipped
+	bool separated(PoolHandle a, const Shape& sa, const ShapePose& pa, float ra, PoolHandle b, const Shape& sb, const ShapePose& pb, float rb) {
+		if (a.slot > b.slot)
+			return separated(b, sb, pb, rb, a, sa, pa, ra);
+		auto inserted = entries.emplace(key(a, b), Entry());
+		Entry& e = inserted.first->second;
+		if (inserted.second) {
+			partnersOf(a.slot).push_back(b.slot);
+			partnersOf(b.slot).push_back(a.slot);
+		}
+		bool fresh = e.generationA != a.generation || e.generationB != b.generation;
+		if (!fresh && e.gap > 0.0f && (travelOf(a) - e.travelA) + (travelOf(b) - e.travelB) < e.gap) {
+			skipped++;
+			return true;
+		}
+		glm::vec3 axis = candidateAxis(sa, pa, sb, pb);
+		float gap = gapAlong(sa, pa, ra, sb, pb, rb, axis);
+		if (!fresh) {
+			float cachedGap = gapAlong(sa, pa, ra, sb, pb, rb, e.axis);
+			if (cachedGap > gap) {
+				gap = cachedGap;
+				axis = e.axis;
+			}
+		}
+		e.generationA = a.generation;
+		e.generationB = b.generation;
+		e.axis = axis;
+		e.gap = gap;
+		e.travelA = travelOf(a);
+		e.travelB = travelOf(b);
+		// the narrow phase looks at the whole step, so the pair has to have been apart since its start
+		if (gap > stepOf(a) + stepOf(b)) {
+			refreshed++;
+			return true;
+		}
+		tested++;
+		return false;
+	}
+
+	// drops every entry of a body, call before it leaves the pool so the cache only holds pairs of live bodies
+	void forget(PoolHandle body) {
+		if (body.slot >= partners.size())
+			return;
+		for (uint32_t other : partners[body.slot]) {
+			entries.erase(body.slot < other ? pairKey(body.slot, other) : pairKey(other, body.slot));
+			std::vector<uint32_t>& back = partners[other];
+			for (size_t i = 0; i < back.size(); i++) {
+				if (back[i] == body.slot) {
+					back[i] = back.back();
+					back.pop_back();
+					break;
+				}
+			}
+		}
+		partners[body.slot].clear();
+	}
+
+	void clear() {
+		entries.clear();
+		partners.clear();
+		travel.clear();
+		lastStep.clear();
+	}
+
+	size_t size() const {
+		return entries.size();
+	}
+
+	// pairs per outcome since resetCounts, skipped ones only did the travel compare
+	int skipped = 0;
+	int refreshed = 0;
+	int tested = 0;
+
+	void resetCounts() {
+		skipped = refreshed = tested = 0;
+	}
+
+private:
+	struct Entry {
+		uint32_t generationA = 0;
+		uint32_t generationB = 0;
+		glm::vec3 axis = glm::vec3(0.0f, 0.0f, 1.0f);
+		float gap = 0.0f;
+		// travel of both bodies when the gap was measured
+		double travelA = 0.0;
+		double travelB = 0.0;
+	};
+
+	std::unordered_map<uint64_t, Entry> entries;
+	// slots each slot has an entry with, so a despawn finds its entries without a sweep
+	std::vector<std::vector<uint32_t>> partners;
+	// accumulated in double so long runs do not lose the per step increments
+	std::vector<double> travel;
+	std::vector<float> lastStep;
+
+	static uint64_t pairKey(uint32_t a, uint32_t b) {
+		return (static_cast<uint64_t>(a) << 32) | b;
+	}
+
+	static uint64_t key(PoolHandle a, PoolHandle b) {
+		return pairKey(a.slot, b.slot);
+	}
+
+	std::vector<uint32_t>& partnersOf(uint32_t slot) {
+		if (slot >= partners.size())
+			partners.resize(slot + 1);
+		return partners[slot];
+	}
+
+	double travelOf(PoolHandle body) const {
+		return body.slot < travel.size() ? travel[body.slot] : 0.0;
+	}
+
+	float stepOf(PoolHandle body) const {
+		return body.slot < lastStep.size() ? lastStep[body.slot] : 0.0f;
+	}
+};
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "shapes.h"
+
+struct ParticleMaterial {
+	float density;
+	float restitution;
+};
+
+// a shape particles bounce off, dynamic ones take the reaction impulse through P and L.
+// inertia is the isotropic scalar constructObj builds
+struct ParticleCollider {
+	Shape shape;
+	ShapePose pose;
+	glm::vec3* P;
+	glm::vec3* L;
+	float m;
+	float inertia;
+	bool dynamic;
+};
+
+// sphere particles for background debris, kept in flat arrays with no mesh or GL state per particle.
+// particles collide with each other through a hashed uniform grid and with analytic shapes through collideShapes
+class ParticleSystem
+{
+public:
+	std::vector<glm::vec3> x;
+	std::vector<glm::vec3> P;
+	std::vector<float> radius;
+	std::vector<uint16_t> material;
+	std::vector<ParticleMaterial> materials;
+
+	size_t add(glm::vec3 position, glm::vec3 momentum, float r, uint16_t mat) {
+		x.push_back(position);
+		P.push_back(momentum);
+		radius.push_back(r);
+		material.push_back(mat);
+		const float volume = 4.0f / 3.0f * 3.14159265f * r * r * r;
+		invMass.push_back(1.0f / (materials[mat].density * volume));
+		maxRadius = glm::max(maxRadius, r);
+		return x.size() - 1;
+	}
+
+	size_t size() const {
+		return x.size();
+	}
+
+	void clear() {
+		x.clear();
+		P.clear();
+		radius.clear();
+		material.clear();
+		invMass.clear();
+		maxRadius = 0.0f;
+	}
+
+	// semi-implicit Euler under the gravity of findDerivativeState, then particle and collider contacts
+	void step(float h, std::vector<ParticleCollider>& colliders) {
+		for (size_t i = 0; i < x.size(); i++) {
+			P[i] += h * glm::vec3(0.0f, 0.0f, -2.0f) / invMass[i];
+			x[i] += h * P[i] * invMass[i];
+		}
+		buildGrid();
+		collideParticles();
+		collideColliders(colliders);
+	}
+
+private:
+	std::vector<float> invMass;
+	float maxRadius = 0.0f;
+	float cellSize = 1.0f;
+	// particles are kept sorted by hash bucket, cellStart[c] .. cellStart[c + 1] are the particles of bucket c
+	std::vector<uint32_t> cellStart;
+	std::vector<uint32_t> sorted;
+	std::vector<uint32_t> cellOf;
+	std::vector<glm::ivec3> coords;
+	std::vector<glm::vec3> scratch;
+	std::vector<uint32_t> bucketStamp;
+	uint32_t stamp = 0;
+
+	static uint32_t hashCell(int cx, int cy, int cz, uint32_t mask) {
+		return (static_cast<uint32_t>(cx) * 73856093u ^ static_cast<uint32_t>(cy) * 19349663u ^ static_cast<uint32_t>(cz) * 83492791u) & mask;
+	}
+
+	glm::ivec3 cellCoord(glm::vec3 p) const {
+		return glm::ivec3(static_cast<int>(std::floor(p.x / cellSize)), static_cast<int>(std::floor(p.y / cellSize)), static_cast<int>(std::floor(p.z / cellSize)));
+	}
+
+	template<typename T>
+	void permute(std::vector<T>& values, std::vector<T>& temp) {
+		temp.resize(values.size());
+		for (size_t k = 0; k < sorted.size(); k++)
+			temp[k] = values[sorted[k]];
+		values.swap(temp);
+	}
+
+	// counting sort of the particles into a power of two hash table of cells. The arrays themselves are
+	// reordered so neighbours sit next to each other in memory, particle indices do not survive a step
+	void buildGrid() {
+		cellSize = glm::max(2.0f * maxRadius, 1e-3f);
+		uint32_t buckets = 1;
+		while (buckets < 2 * x.size())
+			buckets <<= 1;
+		uint32_t mask = buckets - 1;
+		cellStart.assign(buckets + 1, 0);
+		cellOf.resize(x.size());
+		sorted.resize(x.size());
+		for (size_t i = 0; i < x.size(); i++) {
+			glm::ivec3 c = cellCoord(x[i]);
+			cellOf[i] = hashCell(c.x, c.y, c.z, mask);
+			cellStart[cellOf[i] + 1]++;
+		}
+		for (uint32_t c = 0; c < buckets; c++)
+			cellStart[c + 1] += cellStart[c];
+		std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+		for (size_t i = 0; i < x.size(); i++)
+			sorted[fill[cellOf[i]]++] = static_cast<uint32_t>(i);
+		permute(x, scratch);
+		permute(P, scratch);
+		std::vector<float> floats;
+		permute(radius, floats);
+		permute(invMass, floats);
+		std::vector<uint16_t> shorts;
+		permute(material, shorts);
+		coords.resize(x.size());
+		for (size_t i = 0; i < x.size(); i++)
+			coords[i] = cellCoord(x[i]);
+	}
+
+	void resolve(size_t i, size_t j) {
+		glm::vec3 d = x[j] - x[i];
+		float r = radius[i] + radius[j];
+		float dist2 = glm::dot(d, d);
+		if (dist2 >= r * r || dist2 < 1e-12f)
+			return;
+		float dist = std::sqrt(dist2);
+		glm::vec3 n = d / dist;
+		float wi = invMass[i], wj = invMass[j];
+		// push apart by mass ratio, then remove the approaching velocity
+		glm::vec3 correction = n * ((r - dist) / (wi + wj));
+		x[i] -= correction * wi;
+		x[j] += correction * wj;
+		float vn = glm::dot(P[j] * wj - P[i] * wi, n);
+		if (vn >= 0.0f)
+			return;
+		float e = glm::min(materials[material[i]].restitution, materials[material[j]].restitution);
+		glm::vec3 impulse = n * (-(1.0f + e) * vn / (wi + wj));
+		P[i] -= impulse;
+		P[j] += impulse;
+	}
+
+	void collideParticles() {
+		uint32_t mask = static_cast<uint32_t>(cellStart.size() - 2);
+		uint32_t cells[27];
+		int count = 0;
+		for (size_t i = 0; i < x.size(); i++) {
+			// particles of one cell are adjacent after the sort, their neighbour buckets are gathered once
+			glm::ivec3 c = coords[i];
+			if (i == 0 || !(c == coords[i - 1])) {
+				count = 0;
+				for (int dz = -1; dz <= 1; dz++) {
+					for (int dy = -1; dy <= 1; dy++) {
+						for (int dx = -1; dx <= 1; dx++) {
+							// neighbouring cells can hash to the same bucket, visit each bucket once
+							uint32_t cell = hashCell(c.x + dx, c.y + dy, c.z + dz, mask);
+							bool seen = false;
+							for (int k = 0; k < count && !seen; k++)
+								seen = cells[k] == cell;
+							if (!seen)
+								cells[count++] = cell;
+						}
+					}
+				}
+			}
+			for (int n = 0; n < count; n++) {
+				for (uint32_t j = cellStart[cells[n]]; j < cellStart[cells[n] + 1]; j++) {
+					if (j > i)
+						resolve(i, j);
+				}
+			}
+		}
+	}
+
+	// radius around the collider origin that holds its shape, infinite for half-spaces
+	static float colliderRadius(const Shape& shape) {
+		switch (shape.type) {
+		case SHAPE_SPHERE:
+			return shape.radius;
+		case SHAPE_BOX:
+			return glm::length(shape.halfExtents);
+		case SHAPE_CAPSULE:
+			return shape.halfHeight + shape.radius;
+		default:
+			return INFINITY;
+		}
+	}
+
+	// half-spaces touch particles anywhere and go through every particle, finite shapes only visit the grid
+	// cells their bounding sphere overlaps. The cells are padded by one cell since particles have been pushed
+	// around by the particle contacts since the grid was built
+	void collideColliders(std::vector<ParticleCollider>& colliders) {
+		uint32_t mask = static_cast<uint32_t>(cellStart.size() - 2);
+		for (ParticleCollider& c : colliders) {
+			if (c.shape.type == SHAPE_MESH)
+				continue;
+			if (c.shape.type == SHAPE_HALFSPACE) {
+				for (size_t i = 0; i < x.size(); i++)
+					collideCollider(i, c);
+				continue;
+			}
+			float bound = colliderRadius(c.shape);
+			glm::ivec3 lo = cellCoord(c.pose.x - glm::vec3(bound + maxRadius + cellSize));
+			glm::ivec3 hi = cellCoord(c.pose.x + glm::vec3(bound + maxRadius + cellSize));
+			uint64_t cells = uint64_t(hi.x - lo.x + 1) * uint64_t(hi.y - lo.y + 1) * uint64_t(hi.z - lo.z + 1);
+			if (cells >= x.size()) {
+				// a collider larger than the whole cloud, walking the cells would cost more than the particles
+				for (size_t i = 0; i < x.size(); i++) {
+					if (glm::length(x[i] - c.pose.x) <= bound + radius[i])
+						collideCollider(i, c);
+				}
+				continue;
+			}
+			// cells in the range can hash to the same bucket, the stamp keeps each bucket to one visit
+			bucketStamp.resize(cellStart.size() - 1, 0);
+			if (++stamp == 0) {
+				std::fill(bucketStamp.begin(), bucketStamp.end(), 0u);
+				stamp = 1;
+			}
+			for (int cz = lo.z; cz <= hi.z; cz++) {
+				for (int cy = lo.y; cy <= hi.y; cy++) {
+					for (int cx = lo.x; cx <= hi.x; cx++) {
+						uint32_t cell = hashCell(cx, cy, cz, mask);
+						if (bucketStamp[cell] == stamp)
+							continue;
+						bucketStamp[cell] = stamp;
+						for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; i++) {
+							if (glm::length(x[i] - c.pose.x) <= bound + radius[i])
+								collideCollider(i, c);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void collideCollider(size_t i, ParticleCollider& c) {
+		ShapeContact contacts[MAX_SHAPE_CONTACTS];
+		float wb = c.dynamic ? 1.0f / c.m : 0.0f;
+		float ib = c.dynamic ? 1.0f / c.inertia : 0.0f;
+		ShapePose pose = { x[i], glm::mat3x3(1.0f) };
+		int count = collideShapes(makeSphere(radius[i]), pose, c.shape, c.pose, contacts);
+		for (int k = 0; k < count; k++) {
+			// n points from the particle into the collider
+			glm::vec3 n = contacts[k].normal;
+			x[i] -= n * contacts[k].depth;
+			glm::vec3 rb = contacts[k].point - c.pose.x;
+			glm::vec3 vb = c.dynamic ? *c.P * wb + glm::cross(*c.L * ib, rb) : glm::vec3(0.0f);
+			float vn = glm::dot(P[i] * invMass[i] - vb, n);
+			if (vn <= 0.0f)
+				continue;
+			float e = materials[material[i]].restitution;
+			float effective = invMass[i] + wb + glm::dot(n, glm::cross(glm::cross(rb, n) * ib, rb));
+			glm::vec3 impulse = n * ((1.0f + e) * vn / effective);
+			P[i] -= impulse;
+			if (c.dynamic) {
+				*c.P += impulse;
+				*c.L += glm::cross(rb, impulse);
+			}
+		}
+	}
+};
+
+#endif
@@ -7,17 +7,39 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <vector>
+#include <cstring>
+#include <iterator>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+// program binaries are only available from GL 4.1 or with ARB_get_program_binary,
+// without either the shader is always compiled from source
+#if defined(GL_VERSION_4_1) || defined(GL_ARB_get_program_binary)
+#define SHADER_PROGRAM_BINARY
+#endif
+
+// KHR_parallel_shader_compile and ARB_parallel_shader_compile share this token
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // prefix the cached program binaries are written with, an existing directory ending in a separator works too.
+    // defaults to the working directory
+    static std::string& cachePath()
+    {
+        static std::string path;
+        return path;
+    }
+    // constructor generates the shader on the fly, a cached program binary is used when the sources and driver match.
+    // with async the compile is only kicked off, poll ready() until it returns true before using the program
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, bool async = false)
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -59,49 +81,73 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << e.what() << std::endl;
         }
+        // 2. try the binary cache, the key covers the sources and the driver that produced the binary
+        cacheKey = hashString(vertexCode, 14695981039346656037ull);
+        cacheKey = hashString(fragmentCode, cacheKey);
+        cacheKey = hashString(geometryCode, cacheKey);
+        cacheKey = hashString(glString(GL_VENDOR), cacheKey);
+        cacheKey = hashString(glString(GL_RENDERER), cacheKey);
+        cacheKey = hashString(glString(GL_VERSION), cacheKey);
+        ID = glCreateProgram();
+        if (loadBinary())
+        {
+            linked = true;
+            return;
+        }
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
+        // 3. compile shaders, errors are checked once the link has completed so the driver can work in the background
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
         glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
         // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
         if (geometryPath != nullptr)
         {
             const char* gShaderCode = geometryCode.c_str();
             geometry = glCreateShader(GL_GEOMETRY_SHADER);
             glShaderSource(geometry, 1, &gShaderCode, NULL);
             glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
         }
         // shader Program
-        ID = glCreateProgram();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
-        if (geometryPath != nullptr)
+        if (geometry != 0)
             glAttachShader(ID, geometry);
+#ifdef SHADER_PROGRAM_BINARY
+        if (binaryLoaded())
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
         glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if (geometryPath != nullptr)
-            glDeleteShader(geometry);
-
+        if (!async)
+            finishLink();
+    }
+    // returns true once the program is linked, never blocks when the driver supports parallel compile
+    // ------------------------------------------------------------------------
+    bool ready()
+    {
+        if (linked)
+            return true;
+        if (parallelCompileSupported())
+        {
+            GLint done = GL_FALSE;
+            glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+            if (!done)
+                return false;
+        }
+        finishLink();
+        return true;
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use()
     {
+        if (!linked)
+            finishLink();
         glUseProgram(ID);
     }
     // utility uniform functions
@@ -164,9 +210,148 @@ public:
     }
 
 private:
+    unsigned int vertex = 0, fragment = 0, geometry = 0;
+    unsigned long long cacheKey = 0;
+    bool linked = false;
+
+    // checks the compile/link results, drops the shader objects and stores the binary for the next launch
+    // ------------------------------------------------------------------------
+    void finishLink()
+    {
+        bool success = checkCompileErrors(vertex, "VERTEX");
+        success = checkCompileErrors(fragment, "FRAGMENT") && success;
+        if (geometry != 0)
+            success = checkCompileErrors(geometry, "GEOMETRY") && success;
+        success = checkCompileErrors(ID, "PROGRAM") && success;
+        // delete the shaders as they're linked into our program now and no longer necessery
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        if (geometry != 0)
+            glDeleteShader(geometry);
+        vertex = fragment = geometry = 0;
+        if (success)
+            saveBinary();
+        linked = true;
+    }
+    // ------------------------------------------------------------------------
+    static bool parallelCompileSupported()
+    {
+        static int supported = -1;
+        if (supported < 0)
+        {
+            supported = 0;
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count; i++)
+            {
+                const char* ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+                if (ext != nullptr && (std::strcmp(ext, "GL_KHR_parallel_shader_compile") == 0 || std::strcmp(ext, "GL_ARB_parallel_shader_compile") == 0))
+                    supported = 1;
+            }
+        }
+        return supported == 1;
+    }
+    // ------------------------------------------------------------------------
+    // the headers only say glad knows the entry points, on a context below 4.1 without the extension they stay NULL
+    // ------------------------------------------------------------------------
+    static bool binaryLoaded()
+    {
+        bool loaded = false;
+#ifdef GL_VERSION_4_1
+        loaded = loaded || GLAD_GL_VERSION_4_1;
+#endif
+#ifdef GL_ARB_get_program_binary
+        loaded = loaded || GLAD_GL_ARB_get_program_binary;
+#endif
+        return loaded;
+    }
+    // ------------------------------------------------------------------------
+    static bool binarySupported()
+    {
+        GLint formats = 0;
+#ifdef SHADER_PROGRAM_BINARY
+        if (binaryLoaded())
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+#endif
+        return formats > 0;
+    }
+    // 64 bit FNV-1a, chained over every part of the key
+    // ------------------------------------------------------------------------
+    static unsigned long long hashString(const std::string& str, unsigned long long hash)
+    {
+        for (unsigned char c : str)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+    // ------------------------------------------------------------------------
+    static std::string glString(GLenum name)
+    {
+        const GLubyte* str = glGetString(name);
+        return str != nullptr ? std::string(reinterpret_cast<const char*>(str)) : std::string();
+    }
+    // ------------------------------------------------------------------------
+    std::string cacheFile() const
+    {
+        std::stringstream file;
+        file << cachePath() << "shader_" << std::hex << cacheKey << ".bin";
+        return file.str();
+    }
+    // a missing, truncated or rejected binary means the cache is stale and the caller rebuilds from source
+    // ------------------------------------------------------------------------
+    bool loadBinary()
+    {
+#ifdef SHADER_PROGRAM_BINARY
+        if (!binarySupported())
+            return false;
+        std::ifstream file(cacheFile(), std::ios::binary);
+        if (!file)
+            return false;
+        GLenum format = 0;
+        if (!file.read(reinterpret_cast<char*>(&format), sizeof(format)))
+            return false;
+        std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (binary.empty())
+            return false;
+        glProgramBinary(ID, format, binary.data(), static_cast<GLsizei>(binary.size()));
+        GLint success = GL_FALSE;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (success)
+            return true;
+        // the driver refused it, start over with a clean program object
+        glDeleteProgram(ID);
+        ID = glCreateProgram();
+#endif
+        return false;
+    }
+    // ------------------------------------------------------------------------
+    void saveBinary() const
+    {
+#ifdef SHADER_PROGRAM_BINARY
+        if (!binarySupported())
+            return;
+        GLint length = 0;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(ID, length, NULL, &format, binary.data());
+        std::ofstream file(cacheFile(), std::ios::binary);
+        if (!file)
+        {
+            std::cout << "WARNING::SHADER::CACHE_NOT_WRITABLE: " << cacheFile() << std::endl;
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        file.write(binary.data(), binary.size());
+#endif
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -188,7 +373,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success != 0;
     }
 };
 #endif
-
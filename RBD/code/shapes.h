@@ -0,0 +1,473 @@
+#ifndef SHAPES_H
+#define SHAPES_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+// analytic collision shapes, anything left as SHAPE_MESH goes through the vertex/face test
+enum ShapeType {
+	SHAPE_MESH,
+	SHAPE_HALFSPACE,
+	SHAPE_SPHERE,
+	SHAPE_BOX,
+	SHAPE_CAPSULE,
+	SHAPE_COUNT
+};
+
+struct Shape {
+	ShapeType type;
+	glm::vec3 normal;		// half-space normal in the body frame
+	float offset;			// half-space distance from the body origin along normal
+	float radius;			// sphere and capsule
+	glm::vec3 halfExtents;	// box
+	float halfHeight;		// capsule segment half length along the body z axis
+};
+
+// world space pose of a body, the rotation is built once per pair test
+struct ShapePose {
+	glm::vec3 x;
+	glm::mat3x3 R;
+};
+
+// normal points from the first shape towards the second, depth is the penetration along it
+struct ShapeContact {
+	glm::vec3 point;
+	glm::vec3 normal;
+	float depth;
+};
+
+// box against half-space is the largest case with all 8 corners below the plane
+const int MAX_SHAPE_CONTACTS = 8;
+
+inline Shape makeHalfSpace(glm::vec3 normal, float offset) {
+	Shape shape{};
+	shape.type = SHAPE_HALFSPACE;
+	shape.normal = glm::normalize(normal);
+	shape.offset = offset;
+	return shape;
+}
+
+inline Shape makeSphere(float radius) {
+	Shape shape{};
+	shape.type = SHAPE_SPHERE;
+	shape.radius = radius;
+	return shape;
+}
+
+inline Shape makeBox(glm::vec3 halfExtents) {
+	Shape shape{};
+	shape.type = SHAPE_BOX;
+	shape.halfExtents = halfExtents;
+	return shape;
+}
+
+inline Shape makeCapsule(float radius, float halfHeight) {
+	Shape shape{};
+	shape.type = SHAPE_CAPSULE;
+	shape.radius = radius;
+	shape.halfHeight = halfHeight;
+	return shape;
+}
+
+inline ShapePose makePose(glm::vec3 x, glm::quat q) {
+	return { x, glm::toMat3(q) };
+}
+
+// closest point to p on the segment a-b
+inline glm::vec3 closestOnSegment(glm::vec3 p, glm::vec3 a, glm::vec3 b) {
+	glm::vec3 ab = b - a;
+	float len2 = glm::dot(ab, ab);
+	if (len2 < 1e-12f)
+		return a;
+	float t = glm::clamp(glm::dot(p - a, ab) / len2, 0.0f, 1.0f);
+	return a + t * ab;
+}
+
+// closest points between the segments p1-q1 and p2-q2 (Ericson, Real-Time Collision Detection 5.1.9)
+inline void closestBetweenSegments(glm::vec3 p1, glm::vec3 q1, glm::vec3 p2, glm::vec3 q2, glm::vec3& c1, glm::vec3& c2) {
+	glm::vec3 d1 = q1 - p1;
+	glm::vec3 d2 = q2 - p2;
+	glm::vec3 r = p1 - p2;
+	float a = glm::dot(d1, d1);
+	float e = glm::dot(d2, d2);
+	float f = glm::dot(d2, r);
+	float s = 0.0f;
+	float t = 0.0f;
+	if (a < 1e-12f && e < 1e-12f) {
+		c1 = p1;
+		c2 = p2;
+		return;
+	}
+	if (a < 1e-12f) {
+		t = glm::clamp(f / e, 0.0f, 1.0f);
+	}
+	else {
+		float c = glm::dot(d1, r);
+		if (e < 1e-12f) {
+			s = glm::clamp(-c / a, 0.0f, 1.0f);
+		}
+		else {
+			float b = glm::dot(d1, d2);
+			float denom = a * e - b * b;
+			if (denom > 1e-12f)
+				s = glm::clamp((b * f - c * e) / denom, 0.0f, 1.0f);
+			t = (b * s + f) / e;
+			if (t < 0.0f) {
+				t = 0.0f;
+				s = glm::clamp(-c / a, 0.0f, 1.0f);
+			}
+			else if (t > 1.0f) {
+				t = 1.0f;
+				s = glm::clamp((b - c) / a, 0.0f, 1.0f);
+			}
+		}
+	}
+	c1 = p1 + d1 * s;
+	c2 = p2 + d2 * t;
+}
+
+inline void capsuleSegment(const Shape& shape, const ShapePose& pose, glm::vec3& a, glm::vec3& b) {
+	glm::vec3 axis = pose.R * glm::vec3(0.0f, 0.0f, shape.halfHeight);
+	a = pose.x - axis;
+	b = pose.x + axis;
+}
+
+// two spheres of radius ra and rb centred at ca and cb, shared by the sphere and capsule routines
+inline int collidePoints(glm::vec3 ca, float ra, glm::vec3 cb, float rb, ShapeContact* out) {
+	glm::vec3 d = cb - ca;
+	float dist2 = glm::dot(d, d);
+	float r = ra + rb;
+	if (dist2 >= r * r)
+		return 0;
+	float dist = std::sqrt(dist2);
+	glm::vec3 n = dist > 1e-6f ? d / dist : glm::vec3(0.0f, 0.0f, 1.0f);
+	out[0] = { ca + n * ra, n, r - dist };
+	return 1;
+}
+
+// ShapeRoutine<A, B> holds the closed form test for A <= B, pairs without one report -1 and fall back to the mesh path
+template<int A, int B>
+struct ShapeRoutine {
+	static int collide(const Shape&, const ShapePose&, const Shape&, const ShapePose&, ShapeContact*) {
+		return -1;
+	}
+};
+
+template<>
+struct ShapeRoutine<SHAPE_HALFSPACE, SHAPE_SPHERE> {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		glm::vec3 n = pa.R * a.normal;
+		float dist = glm::dot(n, pb.x - pa.x) - a.offset - b.radius;
+		if (dist >= 0.0f)
+			return 0;
+		out[0] = { pb.x - n * b.radius, n, -dist };
+		return 1;
+	}
+};
+
+template<>
+struct ShapeRoutine<SHAPE_HALFSPACE, SHAPE_BOX> {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		glm::vec3 n = pa.R * a.normal;
+		float plane = glm::dot(n, pa.x) + a.offset;
+		// project the box axes on the normal once, each corner is then a signed sum
+		float ex = b.halfExtents.x * glm::dot(n, pb.R[0]);
+		float ey = b.halfExtents.y * glm::dot(n, pb.R[1]);
+		float ez = b.halfExtents.z * glm::dot(n, pb.R[2]);
+		float centre = glm::dot(n, pb.x) - plane;
+		if (centre - std::fabs(ex) - std::fabs(ey) - std::fabs(ez) >= 0.0f)
+			return 0;
+		int count = 0;
+		for (int i = 0; i < 8; i++) {
+			float sx = (i & 1) ? 1.0f : -1.0f;
+			float sy = (i & 2) ? 1.0f : -1.0f;
+			float sz = (i & 4) ? 1.0f : -1.0f;
+			float dist = centre + sx * ex + sy * ey + sz * ez;
+			if (dist < 0.0f) {
+				glm::vec3 corner = pb.x + pb.R * (glm::vec3(sx, sy, sz) * b.halfExtents);
+				out[count++] = { corner, n, -dist };
+			}
+		}
+		return count;
+	}
+};
+
+template<>
+struct ShapeRoutine<SHAPE_HALFSPACE, SHAPE_CAPSULE> {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		glm::vec3 n = pa.R * a.normal;
+		float plane = glm::dot(n, pa.x) + a.offset;
+		glm::vec3 ends[2];
+		capsuleSegment(b, pb, ends[0], ends[1]);
+		int count = 0;
+		for (int i = 0; i < 2; i++) {
+			float dist = glm::dot(n, ends[i]) - plane - b.radius;
+			if (dist < 0.0f)
+				out[count++] = { ends[i] - n * b.radius, n, -dist };
+		}
+		return count;
+	}
+};
+
+template<>
+struct ShapeRoutine<SHAPE_SPHERE, SHAPE_SPHERE> {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		return collidePoints(pa.x, a.radius, pb.x, b.radius, out);
+	}
+};
+
+template<>
+struct ShapeRoutine<SHAPE_SPHERE, SHAPE_BOX> {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		glm::vec3 local = glm::transpose(pb.R) * (pa.x - pb.x);
+		glm::vec3 closest = glm::clamp(local, -b.halfExtents, b.halfExtents);
+		glm::vec3 diff = local - closest;
+		float dist2 = glm::dot(diff, diff);
+		if (dist2 >= a.radius * a.radius)
+			return 0;
+		if (dist2 > 1e-12f) {
+			float dist = std::sqrt(dist2);
+			out[0] = { pb.x + pb.R * closest, -(pb.R * diff) / dist, a.radius - dist };
+			return 1;
+		}
+		// centre inside the box, leave through the nearest face
+		int axis = 0;
+		float least = b.halfExtents.x - std::fabs(local.x);
+		for (int i = 1; i < 3; i++) {
+			float pen = b.halfExtents[i] - std::fabs(local[i]);
+			if (pen < least) {
+				least = pen;
+				axis = i;
+			}
+		}
+		glm::vec3 face(0.0f);
+		face[axis] = local[axis] < 0.0f ? -1.0f : 1.0f;
+		glm::vec3 n = -(pb.R * face);
+		out[0] = { pa.x, n, a.radius + least };
+		return 1;
+	}
+};
+
+template<>
+struct ShapeRoutine<SHAPE_SPHERE, SHAPE_CAPSULE> {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		glm::vec3 s0, s1;
+		capsuleSegment(b, pb, s0, s1);
+		return collidePoints(pa.x, a.radius, closestOnSegment(pa.x, s0, s1), b.radius, out);
+	}
+};
+
+template<>
+struct ShapeRoutine<SHAPE_CAPSULE, SHAPE_CAPSULE> {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		glm::vec3 a0, a1, b0, b1, ca, cb;
+		capsuleSegment(a, pa, a0, a1);
+		capsuleSegment(b, pb, b0, b1);
+		closestBetweenSegments(a0, a1, b0, b1, ca, cb);
+		return collidePoints(ca, a.radius, cb, b.radius, out);
+	}
+};
+
+// half width of a box's projection onto a unit axis
+inline float boxExtent(const Shape& box, const ShapePose& pose, glm::vec3 axis) {
+	return std::fabs(glm::dot(axis, pose.R[0])) * box.halfExtents.x
+		+ std::fabs(glm::dot(axis, pose.R[1])) * box.halfExtents.y
+		+ std::fabs(glm::dot(axis, pose.R[2])) * box.halfExtents.z;
+}
+
+inline bool pointInBox(glm::vec3 p, const Shape& box, const ShapePose& pose, float tolerance) {
+	glm::vec3 local = glm::transpose(pose.R) * (p - pose.x);
+	return std::fabs(local.x) <= box.halfExtents.x + tolerance
+		&& std::fabs(local.y) <= box.halfExtents.y + tolerance
+		&& std::fabs(local.z) <= box.halfExtents.z + tolerance;
+}
+
+inline glm::vec3 boxCorner(const Shape& box, const ShapePose& pose, int i) {
+	glm::vec3 sign((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+	return pose.x + pose.R * (sign * box.halfExtents);
+}
+
+// the edge of the box along axis k that lies furthest in direction n
+inline void boxSupportEdge(const Shape& box, const ShapePose& pose, int k, glm::vec3 n, glm::vec3& a, glm::vec3& b) {
+	glm::vec3 centre = pose.x;
+	for (int i = 0; i < 3; i++) {
+		if (i != k)
+			centre += pose.R[i] * (box.halfExtents[i] * (glm::dot(n, pose.R[i]) < 0.0f ? -1.0f : 1.0f));
+	}
+	a = centre - pose.R[k] * box.halfExtents[k];
+	b = centre + pose.R[k] * box.halfExtents[k];
+}
+
+// separating axis test over the 3 + 3 face normals and the 9 edge cross products. Face contacts take every corner
+// of one box that lies in the other, an edge contact is the closest point pair of the two edges. Edge axes only
+// win when they are clearly shallower, otherwise resting boxes flicker between the two cases
+template<>
+struct ShapeRoutine<SHAPE_BOX, SHAPE_BOX> {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		glm::vec3 d = pb.x - pa.x;
+		float best = INFINITY;
+		glm::vec3 n(0.0f, 0.0f, 1.0f);
+		int edgeA = -1, edgeB = -1;
+		for (int k = 0; k < 15; k++) {
+			glm::vec3 axis;
+			if (k < 3)
+				axis = pa.R[k];
+			else if (k < 6)
+				axis = pb.R[k - 3];
+			else
+				axis = glm::cross(pa.R[(k - 6) / 3], pb.R[(k - 6) % 3]);
+			float len = glm::length(axis);
+			if (len < 1e-6f)
+				continue;
+			axis /= len;
+			float overlap = boxExtent(a, pa, axis) + boxExtent(b, pb, axis) - std::fabs(glm::dot(axis, d));
+			if (overlap <= 0.0f)
+				return 0;
+			if (k < 6 ? overlap < best : overlap < 0.95f * best - 1e-4f) {
+				best = overlap;
+				n = glm::dot(axis, d) < 0.0f ? -axis : axis;
+				edgeA = k < 6 ? -1 : (k - 6) / 3;
+				edgeB = k < 6 ? -1 : (k - 6) % 3;
+			}
+		}
+		// faces of a and b facing each other along n
+		float faceA = glm::dot(n, pa.x) + boxExtent(a, pa, n);
+		float faceB = glm::dot(n, pb.x) - boxExtent(b, pb, n);
+		if (edgeA >= 0) {
+			glm::vec3 a0, a1, b0, b1, ca, cb;
+			boxSupportEdge(a, pa, edgeA, n, a0, a1);
+			boxSupportEdge(b, pb, edgeB, -n, b0, b1);
+			closestBetweenSegments(a0, a1, b0, b1, ca, cb);
+			out[0] = { 0.5f * (ca + cb), n, best };
+			return 1;
+		}
+		ShapeContact found[16];
+		int count = 0;
+		const float tolerance = 1e-4f;
+		for (int i = 0; i < 8; i++) {
+			glm::vec3 p = boxCorner(b, pb, i);
+			if (pointInBox(p, a, pa, tolerance))
+				found[count++] = { p, n, glm::max(faceA - glm::dot(n, p), 0.0f) };
+		}
+		for (int i = 0; i < 8; i++) {
+			glm::vec3 p = boxCorner(a, pa, i);
+			if (pointInBox(p, b, pb, tolerance))
+				found[count++] = { p, n, glm::max(glm::dot(n, p) - faceB, 0.0f) };
+		}
+		if (count == 0) {
+			// neither box has a corner in the other, touch at b's deepest point
+			glm::vec3 p = pb.x;
+			for (int i = 0; i < 3; i++)
+				p -= pb.R[i] * (b.halfExtents[i] * (glm::dot(n, pb.R[i]) < 0.0f ? -1.0f : 1.0f));
+			out[0] = { p, n, best };
+			return 1;
+		}
+		if (count > MAX_SHAPE_CONTACTS) {
+			std::partial_sort(found, found + MAX_SHAPE_CONTACTS, found + count, [](const ShapeContact& x, const ShapeContact& y) { return x.depth > y.depth; });
+			count = MAX_SHAPE_CONTACTS;
+		}
+		for (int i = 0; i < count; i++)
+			out[i] = found[i];
+		return count;
+	}
+};
+
+// spheres along the capsule segment against the box: both end caps, plus the segment point nearest the box when it
+// lies between them. The distance from the box is convex along the segment so a golden section search finds it
+template<>
+struct ShapeRoutine<SHAPE_BOX, SHAPE_CAPSULE> {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		glm::vec3 s0, s1;
+		capsuleSegment(b, pb, s0, s1);
+		glm::vec3 l0 = glm::transpose(pa.R) * (s0 - pa.x);
+		glm::vec3 l1 = glm::transpose(pa.R) * (s1 - pa.x);
+		float lo = 0.0f, hi = 1.0f;
+		const float golden = 0.618034f;
+		for (int i = 0; i < 32; i++) {
+			float t0 = hi - golden * (hi - lo);
+			float t1 = lo + golden * (hi - lo);
+			if (boxDistance2(a, l0 + (l1 - l0) * t0) <= boxDistance2(a, l0 + (l1 - l0) * t1))
+				hi = t1;
+			else
+				lo = t0;
+		}
+		float t = 0.5f * (lo + hi);
+		glm::vec3 centres[3] = { s0, s1, s0 + (s1 - s0) * t };
+		// a segment parallel to a face is as close at its ends as anywhere, only a strictly nearer point adds a sphere
+		float ends = glm::min(boxDistance2(a, l0), boxDistance2(a, l1));
+		int spheres = boxDistance2(a, l0 + (l1 - l0) * t) < ends - 1e-6f ? 3 : 2;
+		Shape sphere = makeSphere(b.radius);
+		int count = 0;
+		for (int i = 0; i < spheres; i++) {
+			ShapePose ps = { centres[i], pb.R };
+			int found = ShapeRoutine<SHAPE_SPHERE, SHAPE_BOX>::collide(sphere, ps, a, pa, out + count);
+			// the sphere routine points from the sphere into the box
+			for (int k = 0; k < found; k++)
+				out[count + k].normal = -out[count + k].normal;
+			count += found;
+		}
+		return count;
+	}
+
+private:
+	static float boxDistance2(const Shape& box, glm::vec3 local) {
+		glm::vec3 diff = local - glm::clamp(local, -box.halfExtents, box.halfExtents);
+		return glm::dot(diff, diff);
+	}
+};
+
+// routes B < A to the ordered routine and flips the normals back
+template<int A, int B, bool Ordered = (A <= B)>
+struct ShapeDispatch {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		return ShapeRoutine<A, B>::collide(a, pa, b, pb, out);
+	}
+};
+
+template<int A, int B>
+struct ShapeDispatch<A, B, false> {
+	static int collide(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+		int count = ShapeRoutine<B, A>::collide(b, pb, a, pa, out);
+		for (int i = 0; i < count; i++)
+			out[i].normal = -out[i].normal;
+		return count;
+	}
+};
+
+typedef int (*ShapeCollideFn)(const Shape&, const ShapePose&, const Shape&, const ShapePose&, ShapeContact*);
+
+template<size_t... I>
+constexpr std::array<ShapeCollideFn, sizeof...(I)> makeShapeTable(std::index_sequence<I...>) {
+	return { { &ShapeDispatch<I / SHAPE_COUNT, I % SHAPE_COUNT>::collide... } };
+}
+
+// fills out with up to MAX_SHAPE_CONTACTS contacts and returns how many, or -1 when the pair has no closed form
+inline int collideShapes(const Shape& a, const ShapePose& pa, const Shape& b, const ShapePose& pb, ShapeContact* out) {
+	static const std::array<ShapeCollideFn, SHAPE_COUNT * SHAPE_COUNT> table = makeShapeTable(std::make_index_sequence<SHAPE_COUNT * SHAPE_COUNT>());
+	return table[a.type * SHAPE_COUNT + b.type](a, pa, b, pb, out);
+}
+
+// bounding shapes fitted to mesh vertices in the body frame, V only needs a pos member
+template<typename V, typename A>
+Shape fitSphere(const std::vector<V, A>& vertices) {
+	float r2 = 0.0f;
+	for (const V& v : vertices)
+		r2 = glm::max(r2, glm::dot(v.pos, v.pos));
+	return makeSphere(std::sqrt(r2));
+}
+
+template<typename V, typename A>
+Shape fitBox(const std::vector<V, A>& vertices) {
+	glm::vec3 he(0.0f);
+	for (const V& v : vertices)
+		he = glm::max(he, glm::abs(v.pos));
+	return makeBox(he);
+}
+
+#endif
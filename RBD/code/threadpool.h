@@ -0,0 +1,77 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads fed from one queue, exceptions thrown by a task come back through its future
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned int count = std::max(1u, std::thread::hardware_concurrency())) {
+		for (unsigned int i = 0; i < count; i++) {
+			workers.emplace_back([this] {
+				while (true) {
+					std::function<void()> task;
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+						if (stopping && tasks.empty())
+							return;
+						task = std::move(tasks.front());
+						tasks.pop();
+					}
+					task();
+				}
+			});
+		}
+	}
+
+	// finishes whatever is still queued before joining
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// the result type is taken from the bound call, std::result_of is gone in C++20
+	template<typename F, typename... Args>
+	auto submit(F&& f, Args&&... args) -> std::future<decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...)())> {
+		typedef decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...)()) Result;
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+		std::future<Result> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push([task] { (*task)(); });
+		}
+		wake.notify_one();
+		return result;
+	}
+
+	size_t size() const {
+		return workers.size();
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
+
+#endif
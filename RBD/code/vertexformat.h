@@ -0,0 +1,78 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// the 12 byte vertex the GPU draws from. The position is a snorm inside the mesh bounds and the normal is
+// GL_INT_2_10_10_10_REV, texture coordinates are left out since the shaders never had them bound.
+// Collision keeps the float vertices. Vertices stay in mesh space, so vertRBD.glsl has to transform both
+// attributes itself:
+//     uniform mat3 normalMatrix;	// rotation of the body, set next to model
+//     FragPos = vec3(model * vec4(aPos, 1.0));
+//     Normal = normalMatrix * aNormal;
+// model includes the dequantization scale, normals must not go through it
+struct RenderVertex {
+	int16_t pos[4]; // w keeps the packed normal on a 4 byte boundary
+	uint32_t normal;
+};
+
+// false for a vertRBD.glsl without normalMatrix, that shader still expects world space float vertices
+inline bool usesPackedVertices(unsigned int program) {
+	return glGetUniformLocation(program, "normalMatrix") != -1;
+}
+
+// maps snorm positions back onto the mesh
+inline glm::mat4 dequantizeMatrix(glm::vec3 centre, float scale) {
+	return glm::scale(glm::translate(glm::mat4(1.0f), centre), glm::vec3(scale));
+}
+
+inline int16_t quantizeSnorm16(float v) {
+	return static_cast<int16_t>(std::round(glm::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+// packs the vertices against their bounding box, returns the matrix the shader's model has to include
+template<typename V, typename VA, typename RA>
+glm::mat4 quantizeVertices(const std::vector<V, VA>& vertices, std::vector<RenderVertex, RA>& out) {
+	out.clear();
+	if (vertices.empty())
+		return glm::mat4(1.0f);
+	glm::vec3 lo = vertices[0].pos;
+	glm::vec3 hi = vertices[0].pos;
+	for (const V& v : vertices) {
+		lo = glm::min(lo, v.pos);
+		hi = glm::max(hi, v.pos);
+	}
+	glm::vec3 centre = 0.5f * (lo + hi);
+	glm::vec3 half = 0.5f * (hi - lo);
+	float scale = glm::max(glm::max(half.x, half.y), glm::max(half.z, 1e-6f));
+	out.reserve(vertices.size());
+	for (const V& v : vertices) {
+		glm::vec3 p = (v.pos - centre) / scale;
+		RenderVertex r;
+		r.pos[0] = quantizeSnorm16(p.x);
+		r.pos[1] = quantizeSnorm16(p.y);
+		r.pos[2] = quantizeSnorm16(p.z);
+		r.pos[3] = 0;
+		r.normal = glm::packSnorm3x10_1x2(glm::vec4(v.normal, 0.0f));
+		out.push_back(r);
+	}
+	return dequantizeMatrix(centre, scale);
+}
+
+// attribute layout of the bound vertex array: position 0, normal 1
+inline void renderVertexAttribs() {
+	glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(RenderVertex), (void*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(RenderVertex), (void*)(4 * sizeof(int16_t)));
+	glEnableVertexAttribArray(1);
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef WORLDBATCH_H
+#define WORLDBATCH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include "shapes.h"
+#include "threadpool.h"
+
+// N independent copies of one scene stepped together. Bodies share shape, mass and inertia across worlds,
+// the state is interleaved so component c of body b in world w sits at c[b * worlds + w] and the integration
+// loop runs over contiguous worlds. Inertia is the scalar of the isotropic tensor constructObj builds.
+// Only bodies with an analytic shape collide, mesh pairs have no batched path.
+class WorldBatch
+{
+public:
+	explicit WorldBatch(size_t worlds) : h(worlds, 0.01f), worlds(worlds) {
+	}
+
+	// adds a body to every world at rest at the origin, all bodies have to be added before setting state
+	size_t addBody(const Shape& shape, float m, float inertia, bool dynamic) {
+		shapes.push_back(shape);
+		mass.push_back(m);
+		this->inertia.push_back(inertia);
+		this->dynamic.push_back(dynamic);
+		for (std::vector<float>* c : components())
+			c->resize(c->size() + worlds, 0.0f);
+		qw.resize(mass.size() * worlds, 1.0f);
+		return mass.size() - 1;
+	}
+
+	void setState(size_t world, size_t body, glm::vec3 x, glm::vec3 P, glm::quat q, glm::vec3 L) {
+		size_t k = body * worlds + world;
+		px[k] = x.x; py[k] = x.y; pz[k] = x.z;
+		Px[k] = P.x; Py[k] = P.y; Pz[k] = P.z;
+		qw[k] = q.w; qx[k] = q.x; qy[k] = q.y; qz[k] = q.z;
+		Lx[k] = L.x; Ly[k] = L.y; Lz[k] = L.z;
+	}
+
+	void getState(size_t world, size_t body, glm::vec3& x, glm::vec3& P, glm::quat& q, glm::vec3& L) const {
+		size_t k = body * worlds + world;
+		x = glm::vec3(px[k], py[k], pz[k]);
+		P = glm::vec3(Px[k], Py[k], Pz[k]);
+		q = glm::quat(qw[k], qx[k], qy[k], qz[k]);
+		L = glm::vec3(Lx[k], Ly[k], Lz[k]);
+	}
+
+	size_t worldCount() const {
+		return worlds;
+	}
+
+	size_t bodyCount() const {
+		return mass.size();
+	}
+
+	// per world time step
+	std::vector<float> h;
+
+	// advances every world by its own h, worlds are split into chunks over the pool when one is given
+	void step(ThreadPool* pool = nullptr) {
+		if (pool == nullptr || pool->size() < 2 || worlds < 2) {
+			stepWorlds(0, worlds);
+			return;
+		}
+		size_t chunks = pool->size() * 4;
+		size_t chunk = (worlds + chunks - 1) / chunks;
+		std::vector<std::future<void>> pending;
+		for (size_t w = 0; w < worlds; w += chunk) {
+			size_t end = w + chunk < worlds ? w + chunk : worlds;
+			pending.push_back(pool->submit([this, w, end] { stepWorlds(w, end); }));
+		}
+		for (std::future<void>& f : pending)
+			f.get();
+	}
+
+private:
+	size_t worlds;
+	std::vector<Shape> shapes;
+	std::vector<float> mass;
+	std::vector<float> inertia;
+	std::vector<uint8_t> dynamic;
+	std::vector<float> px, py, pz, Px, Py, Pz, qw, qx, qy, qz, Lx, Ly, Lz;
+	// sum of last step's contact directions, the contact push findDerivativeState adds
+	std::vector<float> cx, cy, cz;
+
+	// qw is left out, a fresh body needs the identity rotation rather than zero
+	std::vector<std::vector<float>*> components() {
+		return { &px, &py, &pz, &Px, &Py, &Pz, &qx, &qy, &qz, &Lx, &Ly, &Lz, &cx, &cy, &cz };
+	}
+
+	void stepWorlds(size_t w0, size_t w1) {
+		// explicit Euler with the same derivative as findDerivativeState, straight line over the worlds
+		for (size_t b = 0; b < mass.size(); b++) {
+			if (!dynamic[b])
+				continue;
+			float im = 1.0f / mass[b];
+			float ii = 1.0f / inertia[b];
+			size_t base = b * worlds;
+			for (size_t w = w0; w < w1; w++) {
+				size_t k = base + w;
+				float dt = h[w];
+				float ox = Lx[k] * ii, oy = Ly[k] * ii, oz = Lz[k] * ii;
+				float dqw = -0.5f * (ox * qx[k] + oy * qy[k] + oz * qz[k]);
+				float dqx = 0.5f * (ox * qw[k] + oy * qz[k] - oz * qy[k]);
+				float dqy = 0.5f * (oy * qw[k] + oz * qx[k] - ox * qz[k]);
+				float dqz = 0.5f * (oz * qw[k] + ox * qy[k] - oy * qx[k]);
+				px[k] += dt * Px[k] * im;
+				py[k] += dt * Py[k] * im;
+				pz[k] += dt * Pz[k] * im;
+				Px[k] += dt * cx[k] / 5.0f;
+				Py[k] += dt * cy[k] / 5.0f;
+				Pz[k] += dt * (cz[k] / 5.0f - 2.0f);
+				float nw = qw[k] + dt * dqw;
+				float nx = qx[k] + dt * dqx;
+				float ny = qy[k] + dt * dqy;
+				float nz = qz[k] + dt * dqz;
+				float inv = 1.0f / std::sqrt(nw * nw + nx * nx + ny * ny + nz * nz);
+				qw[k] = nw * inv; qx[k] = nx * inv; qy[k] = ny * inv; qz[k] = nz * inv;
+				cx[k] = 0.0f; cy[k] = 0.0f; cz[k] = 0.0f;
+			}
+		}
+		for (size_t w = w0; w < w1; w++)
+			collideWorld(w);
+	}
+
+	void collideWorld(size_t w) {
+		ShapeContact contacts[MAX_SHAPE_CONTACTS];
+		for (size_t i = 0; i < mass.size(); i++) {
+			for (size_t j = i + 1; j < mass.size(); j++) {
+				if (!dynamic[i] && !dynamic[j])
+					continue;
+				int count = collideShapes(shapes[i], pose(i, w), shapes[j], pose(j, w), contacts);
+				for (int c = 0; c < count; c++) {
+					// flipped to point from j towards i like the face normals of the mesh path
+					glm::vec3 dir = -contacts[c].normal;
+					respond(i, w, contacts[c].point, dir);
+					respond(j, w, contacts[c].point, dir);
+				}
+			}
+		}
+	}
+
+	ShapePose pose(size_t b, size_t w) const {
+		size_t k = b * worlds + w;
+		return makePose(glm::vec3(px[k], py[k], pz[k]), glm::quat(qw[k], qx[k], qy[k], qz[k]));
+	}
+
+	// the single point impulse of the collision handling loop in main
+	void respond(size_t b, size_t w, glm::vec3 point, glm::vec3 dir) {
+		if (!dynamic[b])
+			return;
+		size_t k = b * worlds + w;
+		glm::vec3 P(Px[k], Py[k], Pz[k]);
+		glm::vec3 ra = glm::vec3(px[k], py[k], pz[k]) - point;
+		float ii = 1.0f / inertia[b];
+		glm::vec3 vm = P / mass[b] + glm::cross(P * ii, ra);
+		float vmf = glm::dot(vm, dir);
+		float a = -1.0f * vmf / (1.0f / mass[b] + glm::dot(dir, glm::cross(glm::cross(ra, dir) * ii, ra)));
+		glm::vec3 dP = a * dir;
+		glm::vec3 dL = a * glm::cross(ra, dir);
+		Px[k] += dP.x; Py[k] += dP.y; Pz[k] += dP.z;
+		Lx[k] += dL.x; Ly[k] += dL.y; Lz[k] += dL.z;
+		cx[k] += dir.x; cy[k] += dir.y; cz[k] += dir.z;
+	}
+};
+
+#endif